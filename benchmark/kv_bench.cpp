@@ -0,0 +1,682 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "cpp_helpers/latency_histogram.hpp"
+#include "cpp_helpers/network_message.hpp"
+#include "cpp_helpers/networking.hpp"
+#include "embedded_server.hpp"
+
+// Load generator for the key value server. Every connection is its own DEALER socket; the connections are
+// spread over a few threads, each of which drives its share from one poll loop.
+//
+// Closed loop: every connection keeps --pipeline requests in flight and sends the next one as soon as a
+// reply arrives, which measures the throughput the server can sustain.
+// Open loop (--rate): requests are issued on a fixed schedule, whether or not earlier ones were answered.
+// Latency is measured from the time a request was scheduled, not from when it was actually sent, so a
+// stalled server shows up in the percentiles instead of silently slowing the schedule down (coordinated
+// omission).
+
+namespace
+{
+using SteadyClock = std::chrono::steady_clock;
+
+// Upper bound of requests in flight per connection.
+constexpr std::size_t max_in_flight = 4096;
+constexpr std::size_t preload_batch_size = 1000;
+constexpr std::size_t preload_batch_bytes = 4 * 1024 * 1024;
+constexpr long preload_timeout_ms = 10000;
+constexpr auto drain_timeout = std::chrono::seconds(2);
+
+enum class Distribution
+{
+    UNIFORM,
+    ZIPFIAN
+};
+
+enum Operation : std::size_t
+{
+    GET_REQUEST,
+    PUT_REQUEST,
+    DELETE_REQUEST,
+    operation_count
+};
+
+const char *const operation_names[operation_count] = {"get", "put", "delete"};
+
+struct BenchOptions
+{
+    std::string endpoint;
+    // Threads of a server run inside the benchmark, bound to 'endpoint'; 0 benchmarks a running server.
+    std::size_t embedded = 0;
+    std::size_t connections = 16;
+    std::size_t threads = 4;
+    double duration = 10;
+    double warmup = 1;
+    std::size_t keys = 100000;
+    std::size_t key_size = 16;
+    std::size_t value_size = 64;
+    Distribution distribution = Distribution::UNIFORM;
+    double zipf_theta = 0.99;
+    double read_ratio = 0.9;
+    // Requests per second over all connections; 0 runs the closed loop.
+    double rate = 0;
+    std::size_t pipeline = 1;
+    bool preload = false;
+    std::string json_path;
+
+    static BenchOptions parse(int argc, char *argv[]);
+    static std::string usage();
+};
+
+BenchOptions BenchOptions::parse(int argc, char *argv[])
+{
+    if (argc < 2)
+        throw std::invalid_argument("missing host and port or endpoint");
+
+    BenchOptions options;
+    int first_option = 2;
+    if (std::string address = argv[1]; address.find("://") != std::string::npos)
+        options.endpoint = address;
+    else if (argc < 3)
+        throw std::invalid_argument("missing port");
+    else
+    {
+        options.endpoint = net::endpoint(net::TCP, net::IP(address).to_string(), static_cast<net::Port>(std::stoi(argv[2])));
+        first_option = 3;
+    }
+    for (int i = first_option; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--preload")
+        {
+            options.preload = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::invalid_argument("missing value for " + option);
+        std::string value = argv[++i];
+
+        if (option == "--connections")
+            options.connections = std::stoul(value);
+        else if (option == "--threads")
+            options.threads = std::stoul(value);
+        else if (option == "--duration")
+            options.duration = std::stod(value);
+        else if (option == "--warmup")
+            options.warmup = std::stod(value);
+        else if (option == "--keys")
+            options.keys = std::stoul(value);
+        else if (option == "--key-size")
+            options.key_size = std::stoul(value);
+        else if (option == "--value-size")
+            options.value_size = std::stoul(value);
+        else if (option == "--distribution")
+        {
+            if (value == "uniform")
+                options.distribution = Distribution::UNIFORM;
+            else if (value == "zipfian")
+                options.distribution = Distribution::ZIPFIAN;
+            else
+                throw std::invalid_argument("unknown distribution " + value);
+        }
+        else if (option == "--zipf-theta")
+            options.zipf_theta = std::stod(value);
+        else if (option == "--read-ratio")
+            options.read_ratio = std::stod(value);
+        else if (option == "--rate")
+            options.rate = std::stod(value);
+        else if (option == "--pipeline")
+            options.pipeline = std::stoul(value);
+        else if (option == "--json")
+            options.json_path = value;
+        else if (option == "--embedded")
+            options.embedded = std::stoul(value);
+        else
+            throw std::invalid_argument("unknown option " + option);
+    }
+
+    if (options.connections == 0 || options.threads == 0 || options.keys == 0)
+        throw std::invalid_argument("--connections, --threads and --keys must be at least 1");
+    if (options.duration <= 0 || options.warmup < 0 || options.rate < 0)
+        throw std::invalid_argument("--duration must be positive, --warmup and --rate not negative");
+    if (options.key_size > 0xFFFF)
+        throw std::invalid_argument("keys are limited to 65535 bytes");
+    if (options.value_size > net::max_value_size)
+        throw std::invalid_argument("values are limited to " + std::to_string(net::max_value_size) + " bytes");
+    if (options.zipf_theta <= 0 || options.zipf_theta >= 1)
+        throw std::invalid_argument("--zipf-theta must be between 0 and 1");
+    if (options.distribution == Distribution::ZIPFIAN && options.keys < 3)
+        throw std::invalid_argument("a zipfian distribution needs at least 3 keys");
+    if (options.read_ratio < 0 || options.read_ratio > 1)
+        throw std::invalid_argument("--read-ratio must be between 0 and 1");
+    if (options.pipeline == 0 || options.pipeline > max_in_flight)
+        throw std::invalid_argument("--pipeline must be between 1 and " + std::to_string(max_in_flight));
+    options.threads = std::min(options.threads, options.connections);
+    return options;
+}
+
+std::string BenchOptions::usage()
+{
+    return "Usage: kv_bench <host> <port>|<endpoint> [--embedded THREADS] [--connections N] [--threads N] [--duration S] [--warmup S]\n"
+           "                [--keys N] [--key-size BYTES] [--value-size BYTES] [--distribution uniform|zipfian]\n"
+           "                [--zipf-theta T] [--read-ratio R] [--rate OPS] [--pipeline N] [--preload] [--json PATH|-]\n";
+}
+
+// Zipfian ranks after Gray et al., "Quickly generating billion-record synthetic databases", as used by YCSB.
+// Rank 0 is the most popular; ranks are scattered over the keyspace by a hash, so the popular keys do not
+// all sit next to each other.
+class KeyChooser
+{
+private:
+    std::size_t keys;
+    Distribution distribution;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+
+public:
+    KeyChooser(std::size_t keys, Distribution distribution, double theta)
+        : keys(keys),
+          distribution(distribution),
+          theta(theta),
+          alpha(1.0 / (1.0 - theta)),
+          zetan(0),
+          eta(0)
+    {
+        if (distribution != Distribution::ZIPFIAN)
+            return;
+        for (std::size_t i = 1; i <= keys; i++)
+            zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+        auto zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        eta = (1.0 - std::pow(2.0 / keys, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    template <typename Random>
+    std::size_t next(Random &random) const
+    {
+        if (distribution == Distribution::UNIFORM)
+            return std::uniform_int_distribution<std::size_t>(0, keys - 1)(random);
+
+        auto u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        auto uz = u * zetan;
+        std::uint64_t rank;
+        if (uz < 1.0)
+            rank = 0;
+        else if (uz < 1.0 + std::pow(0.5, theta))
+            rank = 1;
+        else
+            rank = std::min<std::uint64_t>(static_cast<std::uint64_t>(keys * std::pow(eta * u - eta + 1.0, alpha)), keys - 1);
+        return scatter(rank) % keys;
+    }
+
+private:
+    static std::uint64_t scatter(std::uint64_t rank)
+    {
+        // FNV-1a over the bytes of the rank.
+        std::uint64_t hash = 14695981039346656037ull;
+        for (int i = 0; i < 8; i++, rank >>= 8)
+            hash = (hash ^ (rank & 0xFF)) * 1099511628211ull;
+        return hash;
+    }
+};
+
+std::string make_key(std::size_t index, std::size_t key_size)
+{
+    auto digits = std::to_string(index);
+    return "k" + std::string(key_size > digits.size() + 1 ? key_size - digits.size() - 1 : 0, '0') + digits;
+}
+
+struct Results
+{
+    std::vector<stats::LatencyHistogram> latency = std::vector<stats::LatencyHistogram>(operation_count);
+    std::uint64_t get_hits = 0;
+    std::uint64_t get_misses = 0;
+    std::uint64_t unanswered = 0;
+    std::uint64_t send_retries = 0;
+
+    void merge(const Results &other)
+    {
+        for (std::size_t i = 0; i < operation_count; i++)
+            latency[i].merge(other.latency[i]);
+        get_hits += other.get_hits;
+        get_misses += other.get_misses;
+        unanswered += other.unanswered;
+        send_retries += other.send_retries;
+    }
+};
+
+struct InFlight
+{
+    SteadyClock::time_point start;
+    Operation operation;
+};
+
+struct Connection
+{
+    std::unique_ptr<net::Client> client;
+    net::RequestId next_id = 0;
+    std::unordered_map<net::RequestId, InFlight> in_flight;
+    // Closed loop: requests owed to the server. Open loop: when the next request is due.
+    std::size_t owed = 0;
+    SteadyClock::time_point next_due;
+};
+
+// A PUT as KeyValueClient sends it: a value above net::max_inline_value_size follows the request in value frames.
+bool send_put(net::Client &client, net::RequestId id, std::string_view key, std::string_view value)
+{
+    if (value.size() <= net::max_inline_value_size)
+    {
+        auto message = net::encode_command(id, net::PutCommand(key, value));
+        return client.send(message);
+    }
+    auto message = net::encode_command(id, net::PutCommand(key, {}));
+    if (!client.send(message, true))
+        return false;
+    auto frames = net::make_value_frames(value);
+    for (std::size_t i = 0; i < frames.size(); i++)
+        client.send(frames[i], i + 1 < frames.size());
+    return true;
+}
+
+class Worker
+{
+private:
+    const BenchOptions &options;
+    const KeyChooser &key_chooser;
+    std::vector<Connection> connections;
+    std::vector<zmq::pollitem_t> items;
+    std::mt19937_64 random;
+    std::string value;
+    SteadyClock::duration interval;
+    SteadyClock::time_point measure_start;
+    Results results;
+
+public:
+    Worker(const BenchOptions &options, const KeyChooser &key_chooser, std::size_t first_connection, std::size_t connection_count,
+           const std::string &identity_prefix, std::uint64_t seed)
+        : options(options),
+          key_chooser(key_chooser),
+          connections(connection_count),
+          random(seed),
+          value(options.value_size, 'v'),
+          interval(0)
+    {
+        for (std::size_t i = 0; i < connection_count; i++)
+        {
+            connections[i].client = std::make_unique<net::Client>(identity_prefix + std::to_string(first_connection + i), options.endpoint);
+            items.push_back({connections[i].client->handle(), 0, ZMQ_POLLIN, 0});
+        }
+        if (options.rate > 0)
+            interval = std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(options.connections / options.rate));
+    }
+
+    const Results &result() const { return results; }
+
+    void run(SteadyClock::time_point start)
+    {
+        measure_start = start + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(options.warmup));
+        auto end = measure_start + std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double>(options.duration));
+
+        // Open-loop connections start staggered, so the requests do not leave in bursts.
+        for (std::size_t i = 0; i < connections.size(); i++)
+        {
+            connections[i].owed = options.pipeline;
+            connections[i].next_due = start + interval * i / connections.size();
+        }
+
+        for (auto now = SteadyClock::now(); now < end; now = SteadyClock::now())
+        {
+            auto timeout_ms = options.rate > 0 ? send_due(now) : send_owed();
+            net::poll(items.data(), items.size(), std::min<long>(timeout_ms, std::chrono::duration_cast<std::chrono::milliseconds>(end - now).count()));
+            receive_replies(options.rate == 0);
+        }
+
+        auto drain_end = SteadyClock::now() + drain_timeout;
+        while (in_flight() > 0 && SteadyClock::now() < drain_end)
+        {
+            net::poll(items.data(), items.size(), 10);
+            receive_replies(false);
+        }
+        results.unanswered = in_flight();
+    }
+
+private:
+    std::size_t in_flight() const
+    {
+        std::size_t count = 0;
+        for (auto &connection : connections)
+            count += connection.in_flight.size();
+        return count;
+    }
+
+    // Returns how long to wait for replies before the next request is due.
+    long send_due(SteadyClock::time_point now)
+    {
+        auto next = SteadyClock::time_point::max();
+        for (auto &connection : connections)
+        {
+            // A request that cannot go out now keeps its due time, so its wait is part of its latency.
+            while (connection.next_due <= now && connection.in_flight.size() < max_in_flight && send(connection, connection.next_due))
+                connection.next_due += interval;
+            next = std::min(next, connection.next_due);
+        }
+        return next <= now ? 0 : static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count());
+    }
+
+    long send_owed()
+    {
+        long timeout_ms = 100;
+        for (auto &connection : connections)
+        {
+            for (; connection.owed > 0; connection.owed--)
+            {
+                if (!send(connection, SteadyClock::now()))
+                {
+                    timeout_ms = 1;
+                    break;
+                }
+            }
+        }
+        return timeout_ms;
+    }
+
+    bool send(Connection &connection, SteadyClock::time_point start)
+    {
+        auto key = make_key(key_chooser.next(random), options.key_size);
+        auto choice = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        // Writes are split evenly between puts and deletes, so the store neither fills up nor runs empty.
+        auto operation = choice < options.read_ratio ? GET_REQUEST : (choice - options.read_ratio) * 2 < 1.0 - options.read_ratio ? PUT_REQUEST : DELETE_REQUEST;
+
+        auto id = connection.next_id;
+        bool sent;
+        if (operation == PUT_REQUEST)
+            sent = send_put(*connection.client, id, key, value);
+        else
+        {
+            auto message = operation == GET_REQUEST ? net::encode_command(id, net::GetCommand(key)) : net::encode_command(id, net::DeleteCommand(key));
+            sent = connection.client->send(message);
+        }
+        if (!sent)
+        {
+            results.send_retries++;
+            return false;
+        }
+
+        connection.next_id++;
+        connection.in_flight[id] = {start, operation};
+        return true;
+    }
+
+    void receive_replies(bool send_next)
+    {
+        for (std::size_t i = 0; i < connections.size(); i++)
+        {
+            if ((items[i].revents & ZMQ_POLLIN) == 0)
+                continue;
+
+            auto &connection = connections[i];
+            zmq::message_t reply;
+            while (connection.client->receive(reply))
+            {
+                auto now = SteadyClock::now();
+                codec::Reader reader(reply.data(), reply.size());
+                net::ResponseMessage header;
+                if (!header.decode(reader))
+                    continue;
+                auto it = connection.in_flight.find(header.id);
+                if (it == connection.in_flight.end())
+                    continue;
+
+                auto [start, operation] = it->second;
+                connection.in_flight.erase(it);
+                if (start >= measure_start)
+                {
+                    results.latency[operation].record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count()));
+                    if (operation == GET_REQUEST)
+                    {
+                        if (static_cast<net::NetworkResponse>(header.data_type) == net::NetworkResponse::KEY_VALUE)
+                            results.get_hits++;
+                        else
+                            results.get_misses++;
+                    }
+                }
+                if (send_next)
+                    connection.owed++;
+            }
+        }
+    }
+};
+
+// Inserts every key once, in batches of bounded size, over a connection of its own. Batches carry their
+// values inline, so values too large for that go one PUT at a time.
+void preload(const BenchOptions &options, const std::string &identity)
+{
+    net::Client client(identity, options.endpoint);
+    zmq::pollitem_t items[] = {{client.handle(), 0, ZMQ_POLLIN, 0}};
+    std::string value(options.value_size, 'v');
+    auto large = options.value_size > net::max_inline_value_size;
+    auto batch_size = large ? 1 : std::clamp<std::size_t>(preload_batch_bytes / (options.key_size + options.value_size + 1), 1, preload_batch_size);
+    net::RequestId id = 0;
+    for (std::size_t first = 0; first < options.keys; first += batch_size, id++)
+    {
+        std::vector<std::string> keys;
+        for (auto i = first; i < std::min(first + batch_size, options.keys); i++)
+            keys.push_back(make_key(i, options.key_size));
+
+        bool sent;
+        if (large)
+            sent = send_put(client, id, keys[0], value);
+        else
+        {
+            net::MultiPutCommand cmd;
+            for (auto &key : keys)
+                cmd.items.emplace_back(key, value);
+            auto message = net::encode_command(id, cmd);
+            sent = client.send(message);
+        }
+        zmq::message_t reply;
+        if (!sent || !net::poll(items, 1, preload_timeout_ms) || !client.receive(reply))
+            throw std::runtime_error("the server did not answer the preload");
+    }
+}
+
+double to_us(std::uint64_t ns)
+{
+    return ns / 1000.0;
+}
+
+void print_text(const BenchOptions &options, const Results &results, const stats::LatencyHistogram &all)
+{
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << options.connections << " connections on " << options.threads << " threads, ";
+    if (options.rate > 0)
+        std::cout << "open loop at " << options.rate << " ops/s";
+    else
+        std::cout << "closed loop with " << options.pipeline << " request(s) in flight per connection";
+    std::cout << ", " << options.duration << " s after " << options.warmup << " s warmup\n"
+              << options.keys << " keys (" << (options.distribution == Distribution::ZIPFIAN ? "zipfian" : "uniform") << "), "
+              << options.key_size << " B keys, " << options.value_size << " B values, " << options.read_ratio * 100 << "% reads\n\n";
+
+    std::cout << "throughput: " << all.count() / options.duration << " ops/s (" << all.count() << " ops)\n";
+    if (auto gets = results.get_hits + results.get_misses; gets > 0)
+        std::cout << "get hit ratio: " << 100.0 * results.get_hits / gets << "%\n";
+    std::cout << "unanswered: " << results.unanswered << ", send retries: " << results.send_retries << "\n\n";
+
+    std::cout << std::left << std::setw(8) << "latency" << std::right << std::setw(12) << "count" << std::setw(10) << "mean"
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p999" << std::setw(10) << "max" << "  (us)\n";
+    auto print_row = [](const char *name, const stats::LatencyHistogram &histogram)
+    {
+        std::cout << std::left << std::setw(8) << name << std::right << std::setw(12) << histogram.count()
+                  << std::setw(10) << histogram.mean() / 1000.0 << std::setw(10) << to_us(histogram.value_at_percentile(50))
+                  << std::setw(10) << to_us(histogram.value_at_percentile(99)) << std::setw(10) << to_us(histogram.value_at_percentile(99.9))
+                  << std::setw(10) << to_us(histogram.max()) << "\n";
+    };
+    for (std::size_t i = 0; i < operation_count; i++)
+    {
+        if (results.latency[i].count() > 0)
+            print_row(operation_names[i], results.latency[i]);
+    }
+    print_row("all", all);
+    std::cout << std::flush;
+}
+
+std::string to_json(const BenchOptions &options, const Results &results, const stats::LatencyHistogram &all)
+{
+    auto histogram_json = [](const stats::LatencyHistogram &histogram)
+    {
+        std::ostringstream json;
+        json << "{\"count\": " << histogram.count() << ", \"mean_ns\": " << static_cast<std::uint64_t>(histogram.mean())
+             << ", \"p50_ns\": " << histogram.value_at_percentile(50) << ", \"p99_ns\": " << histogram.value_at_percentile(99)
+             << ", \"p999_ns\": " << histogram.value_at_percentile(99.9) << ", \"max_ns\": " << histogram.max() << "}";
+        return json.str();
+    };
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"mode\": \"" << (options.rate > 0 ? "open" : "closed") << "\",\n"
+         << "  \"connections\": " << options.connections << ",\n"
+         << "  \"threads\": " << options.threads << ",\n"
+         << "  \"rate\": " << options.rate << ",\n"
+         << "  \"pipeline\": " << options.pipeline << ",\n"
+         << "  \"duration_s\": " << options.duration << ",\n"
+         << "  \"keys\": " << options.keys << ",\n"
+         << "  \"distribution\": \"" << (options.distribution == Distribution::ZIPFIAN ? "zipfian" : "uniform") << "\",\n"
+         << "  \"key_size\": " << options.key_size << ",\n"
+         << "  \"value_size\": " << options.value_size << ",\n"
+         << "  \"read_ratio\": " << options.read_ratio << ",\n"
+         << "  \"throughput_ops\": " << all.count() / options.duration << ",\n"
+         << "  \"get_hits\": " << results.get_hits << ",\n"
+         << "  \"get_misses\": " << results.get_misses << ",\n"
+         << "  \"unanswered\": " << results.unanswered << ",\n"
+         << "  \"send_retries\": " << results.send_retries << ",\n"
+         << "  \"latency\": {\n";
+    for (std::size_t i = 0; i < operation_count; i++)
+        json << "    \"" << operation_names[i] << "\": " << histogram_json(results.latency[i]) << ",\n";
+    json << "    \"all\": " << histogram_json(all) << "\n"
+         << "  }\n"
+         << "}\n";
+    return json.str();
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        BenchOptions options;
+        try
+        {
+            options = BenchOptions::parse(argc, argv);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Invalid arguments: " << e.what() << "\n" << BenchOptions::usage();
+            return 1;
+        }
+
+        // An embedded server, reached over inproc://, measures the store and the protocol without any network stack.
+        std::unique_ptr<EmbeddedServer> server;
+        if (options.embedded > 0)
+        {
+            ServerOptions server_options;
+            server_options.endpoints.push_back(options.endpoint);
+            server_options.threads = options.embedded;
+            logging::logger().set_level(logging::Level::warning);
+            server = std::make_unique<EmbeddedServer>(server_options);
+        }
+
+        std::random_device random_device;
+        auto identity_prefix = "kv_bench-" + std::to_string(random_device()) + "-";
+        if (options.preload)
+        {
+            preload(options, identity_prefix + "preload");
+            std::cout << "Preloaded " << options.keys << " keys." << std::endl;
+        }
+
+        KeyChooser key_chooser(options.keys, options.distribution, options.zipf_theta);
+
+        // Every thread opens its own connections, then all start together.
+        std::vector<std::unique_ptr<Worker>> workers(options.threads);
+        std::vector<std::thread> threads;
+        std::vector<std::promise<void>> ready(options.threads);
+        std::promise<SteadyClock::time_point> start;
+        auto start_future = start.get_future().share();
+        for (std::size_t t = 0; t < options.threads; t++)
+        {
+            auto first = options.connections * t / options.threads;
+            auto count = options.connections * (t + 1) / options.threads - first;
+            auto seed = (static_cast<std::uint64_t>(random_device()) << 32) | random_device();
+            threads.emplace_back([&, t, first, count, seed]
+            {
+                try
+                {
+                    workers[t] = std::make_unique<Worker>(options, key_chooser, first, count, identity_prefix, seed);
+                    ready[t].set_value();
+                }
+                catch (...)
+                {
+                    ready[t].set_exception(std::current_exception());
+                    return;
+                }
+                // No start time means another thread could not connect.
+                if (auto start_time = start_future.get(); start_time != SteadyClock::time_point())
+                    workers[t]->run(start_time);
+            });
+        }
+
+        std::exception_ptr error;
+        for (auto &promise : ready)
+        {
+            try
+            {
+                promise.get_future().get();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        }
+        start.set_value(error ? SteadyClock::time_point() : SteadyClock::now());
+        for (auto &thread : threads)
+            thread.join();
+        if (server)
+            server->stop();
+        if (error)
+            std::rethrow_exception(error);
+
+        Results results;
+        for (auto &worker : workers)
+            results.merge(worker->result());
+        stats::LatencyHistogram all;
+        for (auto &histogram : results.latency)
+            all.merge(histogram);
+
+        print_text(options, results, all);
+        if (options.json_path == "-")
+            std::cout << to_json(options, results, all);
+        else if (!options.json_path.empty())
+            std::ofstream(options.json_path) << to_json(options, results, all);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include "hash_store.hpp"
+#include "persistence.hpp"
+
+// Measures how long a restarting server needs to get its data back: a store of <keys> entries is
+// written as one snapshot plus a WAL tail of <tail_percent>% more mutations, and then recovered.
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string make_key(std::size_t i)
+{
+    return "key:" + std::to_string(i);
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        if (argc > 4)
+        {
+            std::cerr << "Usage: startup_bench [keys = 2000000] [value_size = 64] [tail_percent = 10]\n";
+            return 1;
+        }
+
+        std::size_t keys = argc > 1 ? std::stoul(argv[1]) : 2000000;
+        std::size_t value_size = argc > 2 ? std::stoul(argv[2]) : 64;
+        std::size_t tail = keys * (argc > 3 ? std::stoul(argv[3]) : 10) / 100;
+        std::string value(value_size, 'v');
+
+        PersistenceOptions options;
+        options.directory = (std::filesystem::temp_directory_path() / "kv_startup_bench").string();
+        options.fsync = FsyncPolicy::NEVER;
+        std::filesystem::remove_all(options.directory);
+
+        auto start = Clock::now();
+        {
+            Persistence persistence(options, 0, 1);
+            persistence.recover([](std::string_view, std::string_view) {}, [](std::string_view) {});
+
+            persistence.begin_snapshot();
+            for (std::size_t i = 0; i < keys; i++)
+                persistence.snapshot_entry(make_key(i), value);
+            persistence.end_snapshot();
+            persistence.wait_for_snapshot();
+
+            // The tail overwrites and deletes existing keys and adds new ones.
+            for (std::size_t i = 0; i < tail; i++)
+            {
+                if (i % 3 == 0)
+                    persistence.log_delete(make_key(i));
+                else
+                    persistence.log_put(make_key(keys + i), value);
+            }
+            persistence.commit();
+        }
+        std::cout << "Prepared " << keys << " keys and a tail of " << tail << " mutations in " << seconds_since(start) << " s" << std::endl;
+
+        HashStore store;
+        store.reserve(keys + tail);
+        start = Clock::now();
+        {
+            Persistence persistence(options, 0, 1);
+            persistence.recover([&](std::string_view key, std::string_view value) { store.insert_or_assign(key, value); },
+                                [&](std::string_view key) { store.erase(key); });
+        }
+        auto elapsed = seconds_since(start);
+
+        std::cout << "Recovered " << store.size() << " keys in " << elapsed << " s ("
+                  << static_cast<std::uint64_t>((keys + tail) / elapsed) << " records/s)" << std::endl;
+        std::filesystem::remove_all(options.directory);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hash_store.hpp"
+
+// Compares the shard's HashStore with the std::unordered_map it replaced: insert, lookup and delete
+// throughput over <keys> keys with <value_size> byte values, and the heap bytes taken per entry.
+
+namespace
+{
+std::size_t heap_bytes = 0;
+}
+
+void *operator new(std::size_t size)
+{
+    // Every allocation is prefixed with its size, so operator delete can take it off the count.
+    auto block = static_cast<std::size_t *>(std::malloc(size + sizeof(std::max_align_t)));
+    if (!block)
+        throw std::bad_alloc();
+    *block = size;
+    heap_bytes += size;
+    return reinterpret_cast<char *>(block) + sizeof(std::max_align_t);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (!pointer)
+        return;
+    auto block = reinterpret_cast<std::size_t *>(static_cast<char *>(pointer) - sizeof(std::max_align_t));
+    heap_bytes -= *block;
+    std::free(block);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Result
+{
+    double insert_seconds;
+    double lookup_seconds;
+    double erase_seconds;
+    std::size_t bytes;
+};
+
+struct UnorderedMapStore
+{
+    std::unordered_map<std::string, std::string> map;
+
+    bool insert(std::string_view key, std::string_view value) { return map.try_emplace(std::string(key), value).second; }
+    bool contains(std::string_view key) const { return map.find(std::string(key)) != map.end(); }
+    bool erase(std::string_view key) { return map.erase(std::string(key)) > 0; }
+};
+
+struct HashStoreStore
+{
+    HashStore store;
+
+    bool insert(std::string_view key, std::string_view value) { return store.insert(key, value).second; }
+    bool contains(std::string_view key) const { return store.find(key) != nullptr; }
+    bool erase(std::string_view key) { return store.erase(key); }
+};
+
+double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The keys arrive as string_views into a request, as they do in the server.
+template <typename Store>
+Result run(const std::vector<std::string> &keys, const std::string &value)
+{
+    Result result;
+    std::size_t found = 0;
+    auto bytes_before = heap_bytes;
+    {
+        Store store;
+
+        auto start = Clock::now();
+        for (auto &key : keys)
+            store.insert(key, value);
+        result.insert_seconds = seconds_since(start);
+        result.bytes = heap_bytes - bytes_before;
+
+        start = Clock::now();
+        for (std::size_t round = 0; round < 2; round++)
+        {
+            for (std::size_t i = 0; i < keys.size(); i++)
+                found += store.contains(keys[(i * 7919) % keys.size()]);
+        }
+        result.lookup_seconds = seconds_since(start) / 2;
+
+        start = Clock::now();
+        for (auto &key : keys)
+            store.erase(key);
+        result.erase_seconds = seconds_since(start);
+    }
+    if (found != keys.size() * 2)
+        std::cerr << "Lookup found " << found << " of " << keys.size() * 2 << " keys\n";
+    return result;
+}
+
+void print(const char *name, const Result &result, std::size_t keys)
+{
+    std::cout << name << ":\n"
+              << "\tinsert: " << static_cast<std::uint64_t>(keys / result.insert_seconds) << " ops/s\n"
+              << "\tlookup: " << static_cast<std::uint64_t>(keys / result.lookup_seconds) << " ops/s\n"
+              << "\tdelete: " << static_cast<std::uint64_t>(keys / result.erase_seconds) << " ops/s\n"
+              << "\tmemory: " << result.bytes / keys << " bytes per entry" << std::endl;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        if (argc > 3)
+        {
+            std::cerr << "Usage: store_bench [keys = 2000000] [value_size = 32]\n";
+            return 1;
+        }
+
+        std::size_t key_count = argc > 1 ? std::stoul(argv[1]) : 2000000;
+        std::string value(argc > 2 ? std::stoul(argv[2]) : 32, 'v');
+        if (key_count == 0)
+            throw std::invalid_argument("keys must be positive");
+
+        std::vector<std::string> keys;
+        keys.reserve(key_count);
+        for (std::size_t i = 0; i < key_count; i++)
+            keys.push_back("key:" + std::to_string(i * 2654435761u % 1000000007u));
+
+        std::cout << key_count << " keys, " << value.size() << " byte values" << std::endl;
+        print("std::unordered_map", run<UnorderedMapStore>(keys, value), key_count);
+        print("HashStore", run<HashStoreStore>(keys, value), key_count);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,71 +1,367 @@
+#include <atomic>
 #include "key_value_client.hpp"
 
-KeyValueClient::KeyValueClient(const std::string &identity, const std::string &ip_str, std::uint16_t port)
+namespace
+{
+// Inproc names are global to the process, and several clients may share one identity.
+std::atomic<std::size_t> next_pipe(0);
+} // namespace
+
+KeyValueClient::KeyValueClient(const std::string &identity, const std::string &endpoint, std::size_t max_in_flight, std::size_t near_cache_bytes)
     : identity_(identity),
-      socket(std::make_unique<net::Client>(identity_, net::TCP, net::IP(ip_str), port)),
-      stop_thread(false)
+      socket(std::make_unique<net::Client>(identity_, endpoint)),
+      request_socket(net::Context::instance().create_socket(ZMQ_PAIR)),
+      pipe_socket(net::Context::instance().create_socket(ZMQ_PAIR)),
+      max_in_flight(max_in_flight),
+      near_cache(near_cache_bytes > 0 ? std::make_unique<NearCache>(near_cache_bytes) : nullptr),
+      cache_epoch(0),
+      next_id(0),
+      stopped(false)
+{
+    // The in-flight limit bounds the pipe, so it needs no limit of its own.
+    int no_limit = 0;
+    request_socket->setsockopt(ZMQ_SNDHWM, no_limit);
+    pipe_socket->setsockopt(ZMQ_RCVHWM, no_limit);
+
+    auto pipe = std::to_string(next_pipe++);
+    auto address = "inproc://kv-client-" + pipe;
+    pipe_socket->bind(address);
+    request_socket->connect(address);
+    if (near_cache)
+    {
+        auto monitor_address = "inproc://kv-client-monitor-" + pipe;
+        if (zmq_socket_monitor(socket->handle(), monitor_address.c_str(), ZMQ_EVENT_DISCONNECTED) != 0)
+            throw std::runtime_error("the connection cannot be monitored");
+        monitor_socket.reset(net::Context::instance().create_socket(ZMQ_PAIR));
+        monitor_socket->connect(monitor_address);
+    }
+    thread = std::thread(&KeyValueClient::run, this);
+}
+
+KeyValueClient::~KeyValueClient()
+{
+    stop();
+}
+
+void KeyValueClient::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopped)
+            return;
+        stopped = true;
+        // An empty message tells the background thread to stop.
+        request_socket->send("", 0);
+    }
+    in_flight_cv.notify_all();
+    if (thread.joinable())
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.clear();
+}
+
+std::size_t KeyValueClient::in_flight()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.size();
+}
+
+void KeyValueClient::get(std::string_view key, Callback callback)
+{
+    if (!near_cache)
+    {
+        send(net::GetCommand(key), std::move(callback));
+        return;
+    }
+    if (auto value = near_cache->get(key))
+    {
+        Response response;
+        response.status = net::NetworkResponse::KEY_VALUE;
+        response.value = std::move(*value);
+        callback(std::move(response));
+        return;
+    }
+
+    auto id = next_id++;
+    auto message = net::encode_command(id, net::TrackedGetCommand(key));
+    net::Frames no_frames;
+    enqueue(id, message, no_frames, {std::move(callback), nullptr, std::string(key), true, cache_epoch});
+}
+
+std::future<KeyValueClient::Response> KeyValueClient::get(std::string_view key)
+{
+    std::future<Response> future;
+    get(key, promise_callback(future));
+    return future;
+}
+
+void KeyValueClient::del(std::string_view key, Callback callback)
+{
+    // The server's INVALIDATE would come after the reply; our own reads should not wait for it.
+    if (near_cache)
+        near_cache->erase(key);
+    send(net::DeleteCommand(key), std::move(callback));
+}
+
+std::future<KeyValueClient::Response> KeyValueClient::del(std::string_view key)
+{
+    std::future<Response> future;
+    del(key, promise_callback(future));
+    return future;
+}
+
+void KeyValueClient::put(std::string_view key, std::string_view value, Callback callback)
+{
+    if (value.size() > net::max_inline_value_size)
+        put_chunks(key, net::make_value_frames(value), std::move(callback));
+    else
+        send(net::PutCommand(key, value), std::move(callback));
+}
+
+std::future<KeyValueClient::Response> KeyValueClient::put(std::string_view key, std::string_view value)
+{
+    std::future<Response> future;
+    put(key, value, promise_callback(future));
+    return future;
+}
+
+void KeyValueClient::put_chunks(std::string_view key, net::Frames chunks, Callback callback)
+{
+    auto id = next_id++;
+    auto message = net::encode_command(id, net::PutCommand(key, {}));
+    enqueue(id, message, chunks, {std::move(callback), nullptr});
+}
+
+std::future<KeyValueClient::Response> KeyValueClient::put_chunks(std::string_view key, net::Frames chunks)
+{
+    std::future<Response> future;
+    put_chunks(key, std::move(chunks), promise_callback(future));
+    return future;
+}
 
+void KeyValueClient::get_chunks(std::string_view key, ChunkCallback on_chunk, Callback callback)
 {
-    thread = std::thread([&]() {
-        std::stringstream incoming_msg;
-        while (stop_thread == false)
+    auto id = next_id++;
+    auto message = net::encode_command(id, net::GetCommand(key));
+    net::Frames no_frames;
+    enqueue(id, message, no_frames, {std::move(callback), std::move(on_chunk)});
+}
+
+KeyValueClient::Callback KeyValueClient::promise_callback(std::future<Response> &future)
+{
+    auto promise = std::make_shared<std::promise<Response>>();
+    future = promise->get_future();
+    return [promise](Response response) { promise->set_value(std::move(response)); };
+}
+
+void KeyValueClient::enqueue(net::RequestId id, zmq::message_t &message, net::Frames &frames, Pending request)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (std::this_thread::get_id() != thread.get_id())
+        in_flight_cv.wait(lock, [this] { return pending.size() < max_in_flight || stopped; });
+    if (stopped)
+        throw std::runtime_error("the client is stopped");
+
+    pending.emplace(id, std::move(request));
+    request_socket->send(message, frames.empty() ? 0 : ZMQ_SNDMORE);
+    net::send_more(*request_socket, frames);
+}
+
+void KeyValueClient::run()
+{
+    // Frames the socket could not take yet, because its send buffer was full.
+    std::deque<Outgoing> backlog;
+    // Whether the last frame from the pipe had more frames after it.
+    bool in_message = false;
+    std::vector<zmq::pollitem_t> items{{socket->handle(), 0, ZMQ_POLLIN, 0},
+                                       {static_cast<void *>(*pipe_socket), 0, ZMQ_POLLIN, 0}};
+    if (monitor_socket)
+        items.push_back({static_cast<void *>(*monitor_socket), 0, ZMQ_POLLIN, 0});
+    for (;;)
+    {
+        items[0].events = backlog.empty() ? ZMQ_POLLIN : ZMQ_POLLIN | ZMQ_POLLOUT;
+        if (!net::poll(items.data(), items.size(), -1))
+            continue;
+
+        if (items[1].revents & ZMQ_POLLIN)
         {
-            if (net::ResponseMessage header; socket->receive(incoming_msg) && incoming_msg >> header)
+            zmq::message_t request;
+            while (pipe_socket->recv(&request, ZMQ_NOBLOCK))
             {
-                switch (header.data_type)
+                if (request.size() == 0 && !in_message)
                 {
-                    case static_cast<std::underlying_type<net::NetworkResponse>::type>(net::NetworkResponse::KEY_ADDED):
+                    if (monitor_socket)
                     {
-                        net::KeyAddedResponseData response;
-                        incoming_msg >> response;
-                        std::cout << "The item '" << response.key << ": " << response.value << "' was successfully added to the store." << std::endl;
-                        break;
+                        zmq_socket_monitor(socket->handle(), nullptr, 0);
+                        monitor_socket->close();
                     }
-                    case static_cast<std::underlying_type<net::NetworkResponse>::type>(net::NetworkResponse::KEY_VALUE):
-                    {
-                        net::KeyValueResponseData response;
-                        incoming_msg >> response;
-                        std::cout << "The value of the key '" << response.key << "' is '" << response.value << "'" << std::endl;
-                        break;
-                    }
-                    case static_cast<std::underlying_type<net::NetworkResponse>::type>(net::NetworkResponse::KEY_DELETED):
-                    {
-                        net::KeyDeletedResponseData response;
-                        incoming_msg >> response;
-                        std::cout << "The item with key '" << response.key << "' was successfully removed from the store." << std::endl;
-                        break;
-                    }
-                    case static_cast<std::underlying_type<net::NetworkResponse>::type>(net::NetworkResponse::KEY_DOES_NOT_EXIST):
-                    {
-                        net::KeyNotExistResponseData response;
-                        incoming_msg >> response;
-                        std::cout << "The item with key '" << response.key << "' does NOT exist in the store." << std::endl;
-                        break;
-                    }
-                    case static_cast<std::underlying_type<net::NetworkResponse>::type>(net::NetworkResponse::KEY_ALREADY_EXIST):
-                    {
-                        net::KeyNotExistResponseData response;
-                        incoming_msg >> response;
-                        std::cout << "AN item with key '" << response.key << "' already exist in the store." << std::endl;
-                        break;
-                    }
-                    default:
-                        break;
+                    pipe_socket->close();
+                    return;
                 }
+                in_message = request.more();
+                backlog.push_back({std::move(request), in_message});
+            }
+        }
+
+        while (!backlog.empty() && socket->send(backlog.front().frame, backlog.front().more))
+            backlog.pop_front();
+
+        if (items[0].revents & ZMQ_POLLIN)
+        {
+            zmq::message_t reply;
+            net::Frames frames;
+            while (socket->receive(reply, frames))
+            {
+                complete(reply, frames);
+                frames.clear();
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(33));
         }
-    });
+
+        // Replies to requests sent before the disconnect may still arrive; their epoch keeps them out of the cache.
+        if (monitor_socket && (items[2].revents & ZMQ_POLLIN))
+            drop_near_cache();
+    }
 }
 
-KeyValueClient::~KeyValueClient()
+void KeyValueClient::drop_near_cache()
 {
-    stop();
+    // Only disconnects are monitored, so the events need no decoding.
+    zmq::message_t event;
+    while (monitor_socket->recv(&event, ZMQ_NOBLOCK))
+        ;
+    cache_epoch++;
+    near_cache->clear();
 }
 
-void KeyValueClient::stop()
+void KeyValueClient::complete(const zmq::message_t &reply, net::Frames &frames)
 {
-    stop_thread = true;
-    if (thread.joinable())
-        thread.join();
-}
\ No newline at end of file
+    net::RequestId id;
+    Response response;
+    if (!decode_response(reply, id, response))
+        return;
+    // Pushes answer no request.
+    if (response.status == net::NetworkResponse::INVALIDATE)
+    {
+        if (near_cache)
+        {
+            for (auto &key : response.keys)
+                near_cache->invalidate(key);
+        }
+        return;
+    }
+
+    Pending request;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pending.find(id);
+        if (it == pending.end())
+            return;
+        request = std::move(it->second);
+        pending.erase(it);
+    }
+    in_flight_cv.notify_one();
+
+    // A value sent in frames comes with an empty inline value.
+    if (response.status == net::NetworkResponse::KEY_VALUE && request.on_chunk)
+    {
+        if (!response.value.empty())
+            request.on_chunk(response.value);
+        for (auto &frame : frames)
+            request.on_chunk(std::string_view(static_cast<const char *>(frame.data()), frame.size()));
+        response.value.clear();
+    }
+    else if (response.status == net::NetworkResponse::KEY_VALUE && !frames.empty())
+    {
+        std::size_t size = 0;
+        for (auto &frame : frames)
+            size += frame.size();
+        response.value.reserve(size);
+        for (auto &frame : frames)
+            response.value.append(static_cast<const char *>(frame.data()), frame.size());
+    }
+    if (request.cache && request.cache_epoch == cache_epoch && response.status == net::NetworkResponse::KEY_VALUE)
+        near_cache->insert(request.cached_key, response.value);
+    request.callback(std::move(response));
+}
+
+bool KeyValueClient::decode_response(const zmq::message_t &reply, net::RequestId &id, Response &response)
+{
+    codec::Reader reader(reply.data(), reply.size());
+    net::ResponseMessage header;
+    if (!header.decode(reader))
+        return false;
+    id = header.id;
+    response.status = static_cast<net::NetworkResponse>(header.data_type);
+
+    switch (response.status)
+    {
+    case net::NetworkResponse::KEY_VALUE:
+    {
+        net::KeyValueResponseData data;
+        if (!data.decode(reader))
+            return false;
+        response.value = data.value;
+        return true;
+    }
+    case net::NetworkResponse::KEY_ADDED:
+    case net::NetworkResponse::KEY_DELETED:
+    case net::NetworkResponse::KEY_DOES_NOT_EXIST:
+    case net::NetworkResponse::KEY_ALREADY_EXIST:
+    case net::NetworkResponse::READ_ONLY:
+        return true;
+    case net::NetworkResponse::MULTI_STATUS:
+    {
+        net::MultiStatusResponseData data;
+        if (!data.decode(reader))
+            return false;
+        response.statuses = std::move(data.statuses);
+        return true;
+    }
+    case net::NetworkResponse::MULTI_VALUE:
+    {
+        net::MultiValueResponseData data;
+        if (!data.decode(reader))
+            return false;
+        for (auto &entry : data.entries)
+        {
+            response.statuses.push_back(entry.status);
+            response.values.emplace_back(entry.value);
+        }
+        return true;
+    }
+    case net::NetworkResponse::SCAN_RESULT:
+    {
+        net::ScanResponseData data;
+        if (!data.decode(reader))
+            return false;
+        for (auto &[key, value] : data.items)
+        {
+            response.keys.emplace_back(key);
+            if (data.with_values)
+                response.values.emplace_back(value);
+        }
+        response.more = data.more;
+        return true;
+    }
+    case net::NetworkResponse::INVALIDATE:
+    {
+        net::InvalidateData data;
+        if (!data.decode(reader))
+            return false;
+        for (auto key : data.keys)
+            response.keys.emplace_back(key);
+        return true;
+    }
+    case net::NetworkResponse::STATS:
+    {
+        net::StatsResponseData data;
+        if (!data.decode(reader))
+            return false;
+        response.value = data.text;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
@@ -8,42 +8,154 @@
 #include <random>
 #include <string>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "cpp_helpers/networking.hpp"
 #include "cpp_helpers/network_message.hpp"
+#include "near_cache.hpp"
 
+// Asynchronous client: every request returns at once and completes later, through a callback or a future,
+// when the reply with its id arrives. Any number of requests may be pipelined on the one connection, up to
+// 'max_in_flight'; beyond that a new request waits until an earlier one completes.
+//
+// The connection is owned by a background thread that blocks on the socket. Requests reach it through an
+// inproc pipe, so they can be sent from any thread. Callbacks run on the background thread and should be
+// short; they may send new requests, which then never wait for the in-flight limit.
+//
+// Values above net::max_inline_value_size are sent as value frames of net::value_chunk_size bytes. put_chunks()
+// sends a value in frames the caller built, e.g. one per block of a file, and get_chunks() hands a value
+// over frame by frame as it arrived, so neither side has to hold it in one piece.
+//
+// With a near cache, get() reads with TRACKED_GET and keeps the values it receives; the server then pushes
+// an INVALIDATE once any of those keys is deleted or evicted, and the client drops its copy. A get() of a
+// cached key completes at once, on the calling thread. A value is only as fresh as the pushes that have
+// arrived. Pushes sent while the connection is down are lost and a restarted server knows nothing of the
+// cache, so the whole cache is dropped when the connection drops.
 class KeyValueClient
 {
+public:
+    struct Response
+    {
+        net::NetworkResponse status = net::NetworkResponse::KEY_DOES_NOT_EXIST;
+        // GET: the value, if the key exists; STATS: the metrics text.
+        std::string value;
+        // Batches: the status of every key, and for MULTI_GET the value of every key that exists.
+        std::vector<net::NetworkResponse> statuses;
+        std::vector<std::string> values;
+        // Scans: the keys of the page, their values if they were asked for, and whether keys are left after it.
+        std::vector<std::string> keys;
+        bool more = false;
+    };
+
+    // A callback that is dropped without being called (because the client stopped) breaks its future.
+    using Callback = std::function<void(Response)>;
+    // Called with every piece of a value, in order, before the callback of the request.
+    using ChunkCallback = std::function<void(std::string_view chunk)>;
+
+    static constexpr std::size_t default_max_in_flight = 1024;
+
 private:
+    struct Pending
+    {
+        Callback callback;
+        ChunkCallback on_chunk;
+        // Set for a TRACKED_GET: its value goes to the near cache, unless the connection dropped since it was sent.
+        std::string cached_key;
+        bool cache;
+        std::uint64_t cache_epoch;
+
+        Pending() : cache(false), cache_epoch(0) {}
+        Pending(Callback callback, ChunkCallback on_chunk, std::string cached_key = {}, bool cache = false, std::uint64_t cache_epoch = 0)
+            : callback(std::move(callback)), on_chunk(std::move(on_chunk)), cached_key(std::move(cached_key)), cache(cache),
+              cache_epoch(cache_epoch) {}
+    };
+
+    // A frame on its way to the socket, and whether more frames of its message follow.
+    struct Outgoing
+    {
+        zmq::message_t frame;
+        bool more;
+    };
+
     std::string identity_;
     std::unique_ptr<net::Client> socket;
-    std::atomic_bool stop_thread;
+    std::unique_ptr<zmq::socket_t> request_socket;
+    std::unique_ptr<zmq::socket_t> pipe_socket;
+    std::size_t max_in_flight;
+    std::unique_ptr<NearCache> near_cache;
+    // Tells of the disconnects of 'socket', when there is a near cache; each one starts a new cache epoch.
+    std::unique_ptr<zmq::socket_t> monitor_socket;
+    std::atomic<std::uint64_t> cache_epoch;
+    std::atomic<net::RequestId> next_id;
+    std::mutex mutex;
+    std::condition_variable in_flight_cv;
+    std::unordered_map<net::RequestId, Pending> pending;
+    bool stopped;
     std::thread thread;
 
 public:
-    KeyValueClient(const std::string &identity, const std::string &ip_str, std::uint16_t port);
+    // 'endpoint' is where the server listens, e.g. tcp://127.0.0.1:5555, ipc:///tmp/kv.sock or, for a
+    // server in the same process, inproc://kv. A 'near_cache_bytes' above 0 turns the near cache on and bounds it.
+    KeyValueClient(const std::string &identity, const std::string &endpoint, std::size_t max_in_flight = default_max_in_flight,
+                   std::size_t near_cache_bytes = 0);
     ~KeyValueClient();
 
     const std::string &identity() { return identity_; }
+    // Stops the background thread; requests still in flight are dropped.
     void stop();
+    std::size_t in_flight();
+    // All zero without a near cache.
+    NearCache::Stats near_cache_stats() { return near_cache ? near_cache->stats() : NearCache::Stats(); }
 
-    template <typename T>
-    inline void send(std::uint16_t id, T msg_data);
+    void get(std::string_view key, Callback callback);
+    void put(std::string_view key, std::string_view value, Callback callback);
+    void del(std::string_view key, Callback callback);
+    void stats(Callback callback) { send(net::StatsCommand(), std::move(callback)); }
+    void put_chunks(std::string_view key, net::Frames chunks, Callback callback);
+    // The value goes to 'on_chunk' instead of Response::value.
+    void get_chunks(std::string_view key, ChunkCallback on_chunk, Callback callback);
+
+    std::future<Response> get(std::string_view key);
+    std::future<Response> put(std::string_view key, std::string_view value);
+    std::future<Response> del(std::string_view key);
+    std::future<Response> stats() { return send(net::StatsCommand()); }
+    std::future<Response> put_chunks(std::string_view key, net::Frames chunks);
+
+    // Any command of network_message.hpp, e.g. the batches.
+    template <typename Command>
+    void send(const Command &command, Callback callback);
+    template <typename Command>
+    std::future<Response> send(const Command &command);
+
+private:
+    void enqueue(net::RequestId id, zmq::message_t &message, net::Frames &frames, Pending request);
+    void run();
+    void drop_near_cache();
+    void complete(const zmq::message_t &reply, net::Frames &frames);
+    static bool decode_response(const zmq::message_t &reply, net::RequestId &id, Response &response);
+    static Callback promise_callback(std::future<Response> &future);
 };
 
-template <typename T>
-inline void KeyValueClient::send(std::uint16_t id, T msg_data)
+template <typename Command>
+inline void KeyValueClient::send(const Command &command, Callback callback)
 {
-    static_assert(std::is_base_of<net::ISerializable, T>::value,
-                  "msg_data must be driven from net::ISerializable.");
-    std::stringstream stream;
-    if (stream << net::SendMessage(id, msg_data.type()) << msg_data)
-    {
-        socket->send(stream.str());
-    }
-    else
-    {
-        std::cout << "Stream is invalide" << std::endl;
-    }
+    auto id = next_id++;
+    auto message = net::encode_command(id, command);
+    net::Frames no_frames;
+    enqueue(id, message, no_frames, {std::move(callback), nullptr});
+}
+
+template <typename Command>
+inline std::future<KeyValueClient::Response> KeyValueClient::send(const Command &command)
+{
+    std::future<Response> future;
+    send(command, promise_callback(future));
+    return future;
 }
 
 #endif //!KEY_VALUE_CLIENT_HPP_
@@ -1,14 +1,86 @@
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 #include "key_value_client.hpp"
 
 namespace
 {
 volatile std::sig_atomic_t gSignalStatus;
+
+const char *status_name(net::NetworkResponse status)
+{
+    switch (status)
+    {
+    case net::NetworkResponse::KEY_ADDED:
+        return "added";
+    case net::NetworkResponse::KEY_VALUE:
+        return "found";
+    case net::NetworkResponse::KEY_DELETED:
+        return "removed";
+    case net::NetworkResponse::KEY_DOES_NOT_EXIST:
+        return "does NOT exist";
+    case net::NetworkResponse::KEY_ALREADY_EXIST:
+        return "already exists";
+    case net::NetworkResponse::READ_ONLY:
+        return "refused by a read-only replica";
+    default:
+        return "unknown";
+    }
+}
+
+void print_batch(KeyValueClient::Response response)
+{
+    if (response.status == net::NetworkResponse::READ_ONLY)
+    {
+        std::cout << "The batch request was refused: the server is a read-only replica." << std::endl;
+        return;
+    }
+    std::cout << "The batch request completed:" << '\n';
+    for (auto i = 0u; i < response.statuses.size(); i++)
+    {
+        if (response.statuses[i] == net::NetworkResponse::KEY_VALUE)
+            std::cout << "\tItem " << i << ": '" << response.values[i] << "'" << '\n';
+        else
+            std::cout << "\tItem " << i << ": " << status_name(response.statuses[i]) << '\n';
+    }
+    std::cout << std::flush;
 }
+
+void print_page(KeyValueClient::Response response)
+{
+    std::cout << "The scan returned " << response.keys.size() << " keys:" << '\n';
+    for (auto &key : response.keys)
+        std::cout << "\t'" << key << "'" << '\n';
+    if (response.more)
+        std::cout << "More keys follow; the next cursor is '" << response.keys.back() << "'" << '\n';
+    std::cout << std::flush;
+}
+
+// Reads the file in blocks of one value frame each, so it is never held in one piece.
+net::Frames read_file_chunks(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot open " + path);
+    net::Frames chunks;
+    for (;;)
+    {
+        zmq::message_t chunk(net::value_chunk_size);
+        file.read(static_cast<char *>(chunk.data()), chunk.size());
+        auto count = static_cast<std::size_t>(file.gcount());
+        if (count == 0)
+            break;
+        if (count < chunk.size())
+            chunks.emplace_back(chunk.data(), count);
+        else
+            chunks.push_back(std::move(chunk));
+    }
+    return chunks;
+}
+} // namespace
 void signal_handler(int signal);
 const std::string get_unique_name();
-std::uint16_t unique_id();
 
 
 int main(int argc, char *argv[])
@@ -17,14 +89,20 @@ int main(int argc, char *argv[])
     std::string line;
     try
     {
-        if (argc != 3)
+        // Either an ip and a port or a ZeroMQ endpoint, then the optional near cache size.
+        auto with_endpoint = argc >= 2 && std::string(argv[1]).find("://") != std::string::npos;
+        auto address_args = with_endpoint ? 1 : 2;
+        if (argc != address_args + 1 && argc != address_args + 2)
         {
-            std::cerr << "Usage: client <Ip> <port>\n";
+            std::cerr << "Usage: client <Ip> <port> [near_cache_bytes]\n"
+                      << "       client <endpoint> [near_cache_bytes]\n";
             return 1;
         }
 
-        KeyValueClient key_value_client(get_unique_name(), std::string(argv[1]), std::stoi(argv[2]));
-        //KeyValueClient key_value_client(get_unique_name(), "127.0.0.1", 45678);
+        auto endpoint = with_endpoint ? std::string(argv[1]) : net::endpoint(net::TCP, net::IP(argv[1]).to_string(), static_cast<net::Port>(std::stoi(argv[2])));
+        std::size_t near_cache_bytes = argc == address_args + 2 ? std::stoull(argv[address_args + 1]) : 0;
+        KeyValueClient key_value_client(get_unique_name(), endpoint, KeyValueClient::default_max_in_flight, near_cache_bytes);
+        //KeyValueClient key_value_client(get_unique_name(), "tcp://127.0.0.1:45678");
 
         std::cout << key_value_client.identity() << " started ..." << std::endl;
         while (gSignalStatus == 0)
@@ -32,23 +110,137 @@ int main(int argc, char *argv[])
             if (std::getline(std::cin, line))
             {
                 auto tokkens = str::split(line, " ");
-                if(tokkens.size() >= 2)
+                if(tokkens.size() == 1 && tokkens[0] == "stats")
+                {
+                    key_value_client.stats([](KeyValueClient::Response response) { std::cout << response.value << std::flush; });
+                    if (near_cache_bytes > 0)
+                    {
+                        auto cache = key_value_client.near_cache_stats();
+                        std::cout << "near cache: " << cache.items << " items, " << cache.bytes << " bytes, " << cache.hits << " hits, "
+                                  << cache.misses << " misses, " << cache.invalidations << " invalidations" << std::endl;
+                    }
+                    std::cout << "sending stats command" << std::endl;
+                }
+                else if(tokkens.size() >= 2)
                 {
                     if(tokkens[0] == "put" && tokkens.size() == 3)
                     {
-                        key_value_client.send(unique_id(), net::PutCommand(tokkens[1], tokkens[2]) );
+                        key_value_client.put(tokkens[1], tokkens[2], [key = tokkens[1], value = tokkens[2]](KeyValueClient::Response response) {
+                            if (response.status == net::NetworkResponse::KEY_ADDED)
+                                std::cout << "The item '" << key << ": " << value << "' was successfully added to the store." << std::endl;
+                            else if (response.status == net::NetworkResponse::READ_ONLY)
+                                std::cout << "The item '" << key << "' was not added: the server is a read-only replica." << std::endl;
+                            else
+                                std::cout << "AN item with key '" << key << "' already exist in the store." << std::endl;
+                        });
                         std::cout << "sending put command: " << tokkens[1] << ": " << tokkens[2] << std::endl;
                     }
                     else if(tokkens[0] == "get" && tokkens.size() == 2)
                     {
-                        key_value_client.send(unique_id(), net::GetCommand(tokkens[1]));
+                        key_value_client.get(tokkens[1], [key = tokkens[1]](KeyValueClient::Response response) {
+                            if (response.status == net::NetworkResponse::KEY_VALUE)
+                                std::cout << "The value of the key '" << key << "' is '" << response.value << "'" << std::endl;
+                            else
+                                std::cout << "The item with key '" << key << "' does NOT exist in the store." << std::endl;
+                        });
                         std::cout << "sending get command: " << tokkens[1] << std::endl;
                     }
                     else if(tokkens[0] == "delete" && tokkens.size() == 2)
                     {
-                        key_value_client.send(unique_id(), net::DeleteCommand(tokkens[1]));
+                        key_value_client.del(tokkens[1], [key = tokkens[1]](KeyValueClient::Response response) {
+                            if (response.status == net::NetworkResponse::KEY_DELETED)
+                                std::cout << "The item with key '" << key << "' was successfully removed from the store." << std::endl;
+                            else if (response.status == net::NetworkResponse::READ_ONLY)
+                                std::cout << "The item with key '" << key << "' was not removed: the server is a read-only replica." << std::endl;
+                            else
+                                std::cout << "The item with key '" << key << "' does NOT exist in the store." << std::endl;
+                        });
                         std::cout << "sending delete command: " << tokkens[1] << std::endl;
                     }
+                    else if(tokkens[0] == "putfile" && tokkens.size() == 3)
+                    {
+                        auto chunks = read_file_chunks(tokkens[2]);
+                        std::cout << "sending put command: " << tokkens[1] << ": " << chunks.size() << " chunk(s) of " << tokkens[2] << std::endl;
+                        key_value_client.put_chunks(tokkens[1], std::move(chunks), [key = tokkens[1]](KeyValueClient::Response response) {
+                            if (response.status == net::NetworkResponse::KEY_ADDED)
+                                std::cout << "The item '" << key << "' was successfully added to the store." << std::endl;
+                            else if (response.status == net::NetworkResponse::READ_ONLY)
+                                std::cout << "The item '" << key << "' was not added: the server is a read-only replica." << std::endl;
+                            else
+                                std::cout << "AN item with key '" << key << "' already exist in the store." << std::endl;
+                        });
+                    }
+                    else if(tokkens[0] == "getfile" && tokkens.size() == 3)
+                    {
+                        auto file = std::make_shared<std::ofstream>(tokkens[2], std::ios::binary);
+                        key_value_client.get_chunks(
+                            tokkens[1], [file](std::string_view chunk) { file->write(chunk.data(), chunk.size()); },
+                            [key = tokkens[1], path = tokkens[2], file](KeyValueClient::Response response) {
+                                file->close();
+                                if (response.status == net::NetworkResponse::KEY_VALUE)
+                                    std::cout << "The value of the key '" << key << "' was written to '" << path << "'" << std::endl;
+                                else
+                                    std::cout << "The item with key '" << key << "' does NOT exist in the store." << std::endl;
+                            });
+                        std::cout << "sending get command: " << tokkens[1] << std::endl;
+                    }
+                    else if(tokkens[0] == "mput" && tokkens.size() % 2 == 1)
+                    {
+                        net::MultiPutCommand cmd;
+                        for (auto i = 1u; i + 1 < tokkens.size(); i += 2)
+                            cmd.items.emplace_back(tokkens[i], tokkens[i + 1]);
+                        key_value_client.send(cmd, print_batch);
+                        std::cout << "sending multi put command for " << cmd.items.size() << " items" << std::endl;
+                    }
+                    else if(tokkens[0] == "mget")
+                    {
+                        net::MultiGetCommand cmd(std::vector<std::string_view>(tokkens.begin() + 1, tokkens.end()));
+                        key_value_client.send(cmd, print_batch);
+                        std::cout << "sending multi get command for " << cmd.keys.size() << " keys" << std::endl;
+                    }
+                    else if(tokkens[0] == "mdelete")
+                    {
+                        net::MultiDeleteCommand cmd(std::vector<std::string_view>(tokkens.begin() + 1, tokkens.end()));
+                        key_value_client.send(cmd, print_batch);
+                        std::cout << "sending multi delete command for " << cmd.keys.size() << " keys" << std::endl;
+                    }
+                    else if(tokkens[0] == "scan" && tokkens.size() >= 3 && tokkens.size() <= 5)
+                    {
+                        auto limit = tokkens.size() >= 4 ? static_cast<std::uint32_t>(std::stoul(tokkens[3])) : 0;
+                        auto flags = tokkens.size() == 5 ? net::scan_after_cursor : std::uint8_t(0);
+                        net::ScanCommand cmd(tokkens[1], tokkens[2], limit, flags, tokkens.size() == 5 ? tokkens[4] : std::string_view());
+                        key_value_client.send(cmd, print_page);
+                        std::cout << "sending scan command: " << tokkens[1] << " - " << tokkens[2] << std::endl;
+                    }
+                    else if(tokkens[0] == "pscan" && tokkens.size() <= 4)
+                    {
+                        auto limit = tokkens.size() >= 3 ? static_cast<std::uint32_t>(std::stoul(tokkens[2])) : 0;
+                        auto flags = tokkens.size() == 4 ? net::scan_after_cursor : std::uint8_t(0);
+                        net::PrefixScanCommand cmd(tokkens[1], limit, flags, tokkens.size() == 4 ? tokkens[3] : std::string_view());
+                        key_value_client.send(cmd, print_page);
+                        std::cout << "sending prefix scan command: " << tokkens[1] << std::endl;
+                    }
+                    else if(tokkens[0] == "pdelete" && tokkens.size() == 2)
+                    {
+                        // Deleted keys drop out of the scan, so every page starts at the prefix again.
+                        std::size_t deleted = 0;
+                        for (;;)
+                        {
+                            auto page = key_value_client.send(net::PrefixScanCommand(tokkens[1])).get();
+                            if (page.keys.empty())
+                                break;
+                            net::MultiDeleteCommand cmd(std::vector<std::string_view>(page.keys.begin(), page.keys.end()));
+                            if (key_value_client.send(cmd).get().status == net::NetworkResponse::READ_ONLY)
+                            {
+                                std::cout << "The server is a read-only replica." << std::endl;
+                                break;
+                            }
+                            deleted += page.keys.size();
+                            if (!page.more)
+                                break;
+                        }
+                        std::cout << deleted << " items with the prefix '" << tokkens[1] << "' were removed from the store." << std::endl;
+                    }
                 }
             }
         }
@@ -73,10 +265,3 @@ const std::string get_unique_name()
     std::uniform_int_distribution<> distr(1, 1000000);
     return str::format("client_{}", std::to_string(distr(eng)));
 }
-
-
-std::uint16_t unique_id()
-{
-    static std::uint16_t unique_id_ = 0;
-    return unique_id_++;
-}
\ No newline at end of file
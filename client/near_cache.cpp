@@ -0,0 +1,72 @@
+#include "near_cache.hpp"
+
+std::optional<std::string> NearCache::get(std::string_view key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end())
+    {
+        stats_.misses++;
+        return std::nullopt;
+    }
+    stats_.hits++;
+    items.splice(items.begin(), items, it->second);
+    return it->second->value;
+}
+
+void NearCache::insert(std::string_view key, std::string_view value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto it = index.find(key); it != index.end())
+        erase(it->second);
+    if (key.size() + value.size() + item_overhead > capacity)
+        return;
+
+    items.push_front({std::string(key), std::string(value)});
+    index.emplace(items.front().key, items.begin());
+    stats_.items++;
+    stats_.bytes += item_size(items.front());
+    while (stats_.bytes > capacity)
+        erase(std::prev(items.end()));
+}
+
+bool NearCache::erase(std::string_view key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end())
+        return false;
+    erase(it->second);
+    return true;
+}
+
+void NearCache::invalidate(std::string_view key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats_.invalidations++;
+    if (auto it = index.find(key); it != index.end())
+        erase(it->second);
+}
+
+void NearCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    items.clear();
+    stats_.items = 0;
+    stats_.bytes = 0;
+}
+
+NearCache::Stats NearCache::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats_;
+}
+
+void NearCache::erase(std::list<Item>::iterator it)
+{
+    stats_.items--;
+    stats_.bytes -= item_size(*it);
+    index.erase(it->key);
+    items.erase(it);
+}
@@ -0,0 +1,62 @@
+#ifndef NEAR_CACHE_HPP_
+#define NEAR_CACHE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// The values a client read recently, least recently used first out once they take more than
+// 'capacity' bytes. The server tells the client when a value it handed out is gone, and the client
+// erases it here; the cache itself never expires anything.
+class NearCache
+{
+public:
+    struct Stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t invalidations = 0;
+        std::size_t items = 0;
+        std::size_t bytes = 0;
+    };
+
+private:
+    struct Item
+    {
+        std::string key;
+        std::string value;
+    };
+
+    // Bookkeeping counted for every item besides its key and value.
+    static constexpr std::size_t item_overhead = 64;
+
+    std::size_t capacity;
+    std::mutex mutex;
+    // Most recently used first.
+    std::list<Item> items;
+    std::unordered_map<std::string_view, std::list<Item>::iterator> index;
+    Stats stats_;
+
+public:
+    NearCache(std::size_t capacity) : capacity(capacity) {}
+
+    std::optional<std::string> get(std::string_view key);
+    void insert(std::string_view key, std::string_view value);
+    // Returns whether the key was cached.
+    bool erase(std::string_view key);
+    // Erases a key the server said is gone.
+    void invalidate(std::string_view key);
+    void clear();
+    Stats stats();
+
+private:
+    static std::size_t item_size(const Item &item) { return item.key.size() + item.value.size() + item_overhead; }
+    void erase(std::list<Item>::iterator it);
+};
+
+#endif // !NEAR_CACHE_HPP_
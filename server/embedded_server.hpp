@@ -0,0 +1,32 @@
+#ifndef EMBEDDED_SERVER_HPP_
+#define EMBEDDED_SERVER_HPP_
+
+#include <thread>
+#include "key_value_server.hpp"
+
+// A KeyValueServer on a thread of its own, for programs that serve their own clients, e.g. over inproc://.
+class EmbeddedServer
+{
+private:
+    KeyValueServer server;
+    std::thread thread;
+
+public:
+    EmbeddedServer(const ServerOptions &options) : server(options), thread([this] { server.run(); }) {}
+    ~EmbeddedServer() { stop(); }
+
+    EmbeddedServer(const EmbeddedServer &) = delete;
+    EmbeddedServer &operator=(const EmbeddedServer &) = delete;
+
+    std::string last_endpoint() const { return server.last_endpoint(); }
+
+    void stop()
+    {
+        if (!thread.joinable())
+            return;
+        server.stop();
+        thread.join();
+    }
+};
+
+#endif // !EMBEDDED_SERVER_HPP_
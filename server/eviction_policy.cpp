@@ -0,0 +1,162 @@
+#include <chrono>
+#include <stdexcept>
+#include "eviction_policy.hpp"
+
+std::size_t EvictionPolicy::metadata_size(EvictionPolicyType type)
+{
+    return type == EvictionPolicyType::LRU ? sizeof(LruPolicy::Links) : 0;
+}
+
+std::unique_ptr<EvictionPolicy> EvictionPolicy::create(EvictionPolicyType type, const HashStore &store)
+{
+    switch (type)
+    {
+    case EvictionPolicyType::LRU:
+        return std::make_unique<LruPolicy>(store);
+    case EvictionPolicyType::CLOCK:
+        return std::make_unique<ClockPolicy>(store);
+    case EvictionPolicyType::LFU:
+        return std::make_unique<SampledLfuPolicy>(store);
+    }
+    throw std::invalid_argument("unknown eviction policy");
+}
+
+EvictionPolicyType EvictionPolicy::parse(const std::string &name)
+{
+    if (name == "lru")
+        return EvictionPolicyType::LRU;
+    if (name == "clock")
+        return EvictionPolicyType::CLOCK;
+    if (name == "lfu")
+        return EvictionPolicyType::LFU;
+    throw std::invalid_argument("unknown eviction policy " + name);
+}
+
+LruPolicy::LruPolicy(const HashStore &store)
+    : store(store),
+      head(nullptr),
+      tail(nullptr)
+{
+}
+
+void LruPolicy::inserted(const HashStore::Entry &entry)
+{
+    link_front(entry);
+}
+
+void LruPolicy::accessed(const HashStore::Entry &entry)
+{
+    if (head == &entry)
+        return;
+    unlink(entry);
+    link_front(entry);
+}
+
+void LruPolicy::erased(const HashStore::Entry &entry)
+{
+    unlink(entry);
+}
+
+void LruPolicy::link_front(const HashStore::Entry &entry)
+{
+    links(entry) = {nullptr, head};
+    if (head)
+        links(*head).previous = &entry;
+    else
+        tail = &entry;
+    head = &entry;
+}
+
+void LruPolicy::unlink(const HashStore::Entry &entry)
+{
+    auto &entry_links = links(entry);
+    if (entry_links.previous)
+        links(*entry_links.previous).next = entry_links.next;
+    else
+        head = entry_links.next;
+    if (entry_links.next)
+        links(*entry_links.next).previous = entry_links.previous;
+    else
+        tail = entry_links.previous;
+}
+
+ClockPolicy::ClockPolicy(const HashStore &store)
+    : store(store),
+      hand(0)
+{
+}
+
+const HashStore::Entry *ClockPolicy::victim()
+{
+    // Every referenced entry the hand passes loses its bit, so two sweeps always find a victim.
+    for (;;)
+    {
+        if (hand >= store.slot_count())
+            hand = 0;
+        auto entry = store.slot(hand++);
+        if (!entry)
+            continue;
+        if (entry->eviction_bits() == 0)
+            return entry;
+        entry->set_eviction_bits(0);
+    }
+}
+
+SampledLfuPolicy::SampledLfuPolicy(const HashStore &store)
+    : store(store)
+{
+}
+
+void SampledLfuPolicy::inserted(const HashStore::Entry &entry)
+{
+    entry.set_eviction_bits(static_cast<std::uint16_t>(now_minutes() << 8 | initial_count));
+}
+
+void SampledLfuPolicy::accessed(const HashStore::Entry &entry)
+{
+    unsigned count = decayed_count(entry);
+    // The more accesses an entry has, the less likely one more raises its count: 255 is reached after
+    // about a million accesses.
+    if (count < 255)
+    {
+        auto base = count > initial_count ? count - initial_count : 0;
+        if (random() % (base * log_factor + 1) == 0)
+            count++;
+    }
+    entry.set_eviction_bits(static_cast<std::uint16_t>(now_minutes() << 8 | count));
+}
+
+const HashStore::Entry *SampledLfuPolicy::victim()
+{
+    const HashStore::Entry *victim = nullptr;
+    unsigned victim_count = 256;
+    for (std::size_t n = 0; n < samples; n++)
+    {
+        // The first entry at or after a random slot; the walk wraps around the table.
+        auto index = random() % store.slot_count();
+        while (!store.slot(index))
+            index = (index + 1) % store.slot_count();
+
+        auto entry = store.slot(index);
+        if (unsigned count = decayed_count(*entry); count < victim_count)
+        {
+            victim = entry;
+            victim_count = count;
+        }
+    }
+    return victim;
+}
+
+std::uint8_t SampledLfuPolicy::now_minutes()
+{
+    auto minutes = std::chrono::duration_cast<std::chrono::minutes>(std::chrono::steady_clock::now().time_since_epoch());
+    return static_cast<std::uint8_t>(minutes.count());
+}
+
+std::uint8_t SampledLfuPolicy::decayed_count(const HashStore::Entry &entry)
+{
+    auto bits = entry.eviction_bits();
+    std::uint8_t count = bits & 0xFF;
+    std::uint8_t idle_minutes = static_cast<std::uint8_t>(now_minutes() - (bits >> 8));
+    return count > idle_minutes ? count - idle_minutes : 0;
+}
@@ -0,0 +1,121 @@
+#ifndef EVICTION_POLICY_HPP_
+#define EVICTION_POLICY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include "hash_store.hpp"
+
+enum class EvictionPolicyType
+{
+    LRU,
+    CLOCK,
+    LFU
+};
+
+struct EvictionOptions
+{
+    // Upper bound for the bytes of the entries, large values included; the hash table and the key index come on
+    // top. 0 lets the store grow without limit.
+    std::size_t max_memory = 0;
+    EvictionPolicyType policy = EvictionPolicyType::LRU;
+
+    bool enabled() const { return max_memory > 0; }
+};
+
+// Picks the entry to drop when the store is over its memory limit. The store tells the policy about every
+// entry it adds, reads and erases; all of these, and finding a victim, take amortized O(1).
+class EvictionPolicy
+{
+public:
+    virtual ~EvictionPolicy() = default;
+
+    virtual void inserted(const HashStore::Entry &entry) = 0;
+    virtual void accessed(const HashStore::Entry &entry) = 0;
+    virtual void erased(const HashStore::Entry &entry) = 0;
+    // The entry to evict next; the store must not be empty.
+    virtual const HashStore::Entry *victim() = 0;
+
+    // Bytes of HashStore metadata the policy needs per entry.
+    static std::size_t metadata_size(EvictionPolicyType type);
+    static std::unique_ptr<EvictionPolicy> create(EvictionPolicyType type, const HashStore &store);
+    static EvictionPolicyType parse(const std::string &name);
+};
+
+// Least recently used: a doubly linked list through the entries' metadata, most recent first.
+class LruPolicy : public EvictionPolicy
+{
+public:
+    struct Links
+    {
+        const HashStore::Entry *previous;
+        const HashStore::Entry *next;
+    };
+
+private:
+    const HashStore &store;
+    const HashStore::Entry *head;
+    const HashStore::Entry *tail;
+
+public:
+    explicit LruPolicy(const HashStore &store);
+
+    void inserted(const HashStore::Entry &entry) override;
+    void accessed(const HashStore::Entry &entry) override;
+    void erased(const HashStore::Entry &entry) override;
+    const HashStore::Entry *victim() override { return tail; }
+
+private:
+    Links &links(const HashStore::Entry &entry) const { return *static_cast<Links *>(store.metadata(entry)); }
+    void link_front(const HashStore::Entry &entry);
+    void unlink(const HashStore::Entry &entry);
+};
+
+// Second chance: a hand sweeps the table slots and evicts the first entry not referenced since the
+// hand last passed it. Needs one bit per entry instead of a list.
+class ClockPolicy : public EvictionPolicy
+{
+private:
+    static constexpr std::uint16_t referenced = 1;
+
+    const HashStore &store;
+    std::size_t hand;
+
+public:
+    explicit ClockPolicy(const HashStore &store);
+
+    void inserted(const HashStore::Entry &entry) override { entry.set_eviction_bits(referenced); }
+    void accessed(const HashStore::Entry &entry) override { entry.set_eviction_bits(referenced); }
+    void erased(const HashStore::Entry &) override {}
+    const HashStore::Entry *victim() override;
+};
+
+// Least frequently used, approximated: every entry has a logarithmic 8-bit access counter that decays
+// by one per idle minute, and the victim is the entry with the lowest count among a few random ones.
+// The counter and the minute it was last decayed share the entry's 16 eviction bits.
+class SampledLfuPolicy : public EvictionPolicy
+{
+private:
+    static constexpr std::size_t samples = 5;
+    static constexpr std::uint8_t initial_count = 5;
+    static constexpr unsigned log_factor = 10;
+
+    const HashStore &store;
+    std::minstd_rand random;
+
+public:
+    explicit SampledLfuPolicy(const HashStore &store);
+
+    void inserted(const HashStore::Entry &entry) override;
+    void accessed(const HashStore::Entry &entry) override;
+    void erased(const HashStore::Entry &) override {}
+    const HashStore::Entry *victim() override;
+
+private:
+    static std::uint8_t now_minutes();
+    static std::uint8_t decayed_count(const HashStore::Entry &entry);
+};
+
+#endif // !EVICTION_POLICY_HPP_
@@ -0,0 +1,205 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "file_io.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+[[noreturn]] void throw_io_error(const std::string &what, const std::string &path)
+{
+    throw std::runtime_error(what + " '" + path + "': " + std::strerror(errno));
+}
+} // namespace
+
+#ifdef _WIN32
+
+AppendFile::AppendFile(const std::string &path)
+    : fd(_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE)),
+      path_(path),
+      size_(0)
+{
+    if (fd < 0)
+        throw_io_error("Cannot open", path);
+    size_ = static_cast<std::uint64_t>(_lseeki64(fd, 0, SEEK_END));
+}
+
+AppendFile::~AppendFile()
+{
+    _close(fd);
+}
+
+void AppendFile::append(const void *data, std::size_t size)
+{
+    auto bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        auto chunk = static_cast<unsigned int>(size < (1u << 30) ? size : (1u << 30));
+        auto written = _write(fd, bytes, chunk);
+        if (written < 0)
+            throw_io_error("Cannot write", path_);
+        bytes += written;
+        size -= written;
+        size_ += written;
+    }
+}
+
+void AppendFile::sync()
+{
+    if (_commit(fd) != 0)
+        throw_io_error("Cannot sync", path_);
+}
+
+MappedFile::MappedFile(const std::string &path)
+    : data_(nullptr), size_(0), file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr)
+{
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Cannot open '" + path + "'");
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file_handle, &size))
+    {
+        size_ = static_cast<std::size_t>(size.QuadPart);
+        if (size_ == 0)
+            return;
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_handle != nullptr)
+            data_ = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (data_ == nullptr)
+    {
+        if (mapping_handle)
+            CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        throw std::runtime_error("Cannot map '" + path + "'");
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+}
+
+void sync_directory(const std::string &)
+{
+}
+
+#else
+
+AppendFile::AppendFile(const std::string &path)
+    : fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)),
+      path_(path),
+      size_(0)
+{
+    if (fd < 0)
+        throw_io_error("Cannot open", path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        // The destructor does not run for a constructor that throws.
+        auto error = errno;
+        ::close(fd);
+        errno = error;
+        throw_io_error("Cannot stat", path);
+    }
+    size_ = static_cast<std::uint64_t>(st.st_size);
+}
+
+AppendFile::~AppendFile()
+{
+    ::close(fd);
+}
+
+void AppendFile::append(const void *data, std::size_t size)
+{
+    auto bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        auto written = ::write(fd, bytes, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw_io_error("Cannot write", path_);
+        }
+        bytes += written;
+        size -= written;
+        size_ += written;
+    }
+}
+
+void AppendFile::sync()
+{
+#if defined(__APPLE__)
+    if (::fsync(fd) != 0)
+#else
+    if (::fdatasync(fd) != 0)
+#endif
+        throw_io_error("Cannot sync", path_);
+}
+
+MappedFile::MappedFile(const std::string &path)
+    : data_(nullptr), size_(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw_io_error("Cannot open", path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        auto error = errno;
+        ::close(fd);
+        errno = error;
+        throw_io_error("Cannot stat", path);
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ > 0)
+    {
+        void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            auto error = errno;
+            ::close(fd);
+            errno = error;
+            throw_io_error("Cannot map", path);
+        }
+        // Recovery reads the file once, front to back.
+        ::madvise(data, size_, MADV_SEQUENTIAL);
+        ::madvise(data, size_, MADV_WILLNEED);
+        data_ = data;
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+        ::munmap(const_cast<void *>(data_), size_);
+}
+
+void sync_directory(const std::string &directory)
+{
+    int fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw_io_error("Cannot open", directory);
+    ::fsync(fd);
+    ::close(fd);
+}
+
+#endif
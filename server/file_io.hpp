@@ -0,0 +1,58 @@
+#ifndef FILE_IO_HPP_
+#define FILE_IO_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Thin, portable wrappers over the few file operations the persistence layer needs.
+// All of them throw std::runtime_error on failure.
+
+// A file opened for appending, with an explicit sync to stable storage.
+class AppendFile
+{
+private:
+    int fd;
+    std::string path_;
+    std::uint64_t size_;
+
+public:
+    AppendFile(const std::string &path);
+    ~AppendFile();
+
+    AppendFile(const AppendFile &) = delete;
+    AppendFile &operator=(const AppendFile &) = delete;
+
+    const std::string &path() const { return path_; }
+    std::uint64_t size() const { return size_; }
+
+    void append(const void *data, std::size_t size);
+    void sync();
+};
+
+// A read-only memory mapping of a whole file.
+class MappedFile
+{
+private:
+    const void *data_;
+    std::size_t size_;
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#endif
+
+public:
+    MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const void *data() const { return data_; }
+    std::size_t size() const { return size_; }
+};
+
+// Makes a rename or an unlink in 'directory' durable. A no-op where the platform has no such notion.
+void sync_directory(const std::string &directory);
+
+#endif // !FILE_IO_HPP_
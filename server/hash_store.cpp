@@ -0,0 +1,212 @@
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include "hash_store.hpp"
+
+HashStore::HashStore(std::size_t metadata_size)
+    : metadata_size((metadata_size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t)),
+      size_(0),
+      tombstones(0),
+      shift(64)
+{
+    rehash(min_slot_count);
+}
+
+HashStore::~HashStore()
+{
+    clear();
+}
+
+const HashStore::Entry *HashStore::find(std::string_view key) const
+{
+    auto index = find_slot(key, hash_of(key));
+    return index == npos ? nullptr : slots[index].entry;
+}
+
+std::pair<const HashStore::Entry *, bool> HashStore::insert(std::string_view key, std::string_view value, bool external)
+{
+    grow_if_needed();
+
+    auto hash = hash_of(key);
+    auto mask = slots.size() - 1;
+    auto free_slot = npos;
+    for (auto index = home_of(hash);; index = (index + 1) & mask)
+    {
+        auto &slot = slots[index];
+        if (slot.entry)
+        {
+            if (slot.hash == hash && slot.entry->key() == key)
+                return {slot.entry, false};
+        }
+        else if (slot.hash == erased_slot)
+        {
+            if (free_slot == npos)
+                free_slot = index;
+        }
+        else
+        {
+            if (free_slot == npos)
+                free_slot = index;
+            else
+                tombstones--;
+            slots[free_slot] = {hash, make_entry(key, value, external)};
+            size_++;
+            return {slots[free_slot].entry, true};
+        }
+    }
+}
+
+void HashStore::insert_or_assign(std::string_view key, std::string_view value)
+{
+    auto index = find_slot(key, hash_of(key));
+    if (index == npos)
+    {
+        insert(key, value);
+        return;
+    }
+
+    auto &entry = slots[index].entry;
+    auto old_size = block_size(entry->key_size_, entry->value_size());
+    auto new_size = block_size(key.size(), value.size());
+    if (allocator.block_size(old_size) == allocator.block_size(new_size) && value.size() <= Entry::max_value_size)
+    {
+        entry->value_size_ = static_cast<std::uint32_t>(value.size());
+        std::memcpy(entry->data() + entry->key_size_, value.data(), value.size());
+    }
+    else
+    {
+        auto replacement = make_entry(key, value);
+        free_entry(entry);
+        entry = replacement;
+    }
+}
+
+bool HashStore::erase(std::string_view key)
+{
+    auto index = find_slot(key, hash_of(key));
+    if (index == npos)
+        return false;
+
+    free_entry(slots[index].entry);
+    slots[index] = {erased_slot, nullptr};
+    size_--;
+    tombstones++;
+    return true;
+}
+
+void HashStore::erase(const Entry &entry)
+{
+    auto hash = hash_of(entry.key());
+    auto mask = slots.size() - 1;
+    auto index = home_of(hash);
+    while (slots[index].entry != &entry)
+        index = (index + 1) & mask;
+
+    free_entry(slots[index].entry);
+    slots[index] = {erased_slot, nullptr};
+    size_--;
+    tombstones++;
+}
+
+void HashStore::clear()
+{
+    for (auto &slot : slots)
+    {
+        if (slot.entry)
+            free_entry(slot.entry);
+        slot = {empty_slot, nullptr};
+    }
+    allocator.clear();
+    size_ = 0;
+    tombstones = 0;
+}
+
+void HashStore::reserve(std::size_t count)
+{
+    auto slot_count = slots.size();
+    while (count * 4 > slot_count * 3)
+        slot_count *= 2;
+    if (slot_count != slots.size())
+        rehash(slot_count);
+}
+
+std::uint64_t HashStore::hash_of(std::string_view key)
+{
+    auto hash = static_cast<std::uint64_t>(std::hash<std::string_view>{}(key));
+    // The two smallest values mark free slots.
+    return hash > erased_slot ? hash : hash + 2;
+}
+
+std::size_t HashStore::home_of(std::uint64_t hash) const
+{
+    // Fibonacci hashing takes the slot from the high bits: shards are picked by hash modulo the shard
+    // count, so the low bits of the hashes of one shard are anything but uniform.
+    return static_cast<std::size_t>((hash * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+std::size_t HashStore::find_slot(std::string_view key, std::uint64_t hash) const
+{
+    auto mask = slots.size() - 1;
+    for (auto index = home_of(hash);; index = (index + 1) & mask)
+    {
+        auto &slot = slots[index];
+        if (slot.entry)
+        {
+            if (slot.hash == hash && slot.entry->key() == key)
+                return index;
+        }
+        else if (slot.hash == empty_slot)
+        {
+            return npos;
+        }
+    }
+}
+
+HashStore::Entry *HashStore::make_entry(std::string_view key, std::string_view value, bool external)
+{
+    if (value.size() > Entry::max_value_size)
+        throw std::length_error("value too large for the hash store");
+    auto block = static_cast<char *>(allocator.allocate(block_size(key.size(), value.size())));
+    auto entry = reinterpret_cast<Entry *>(block + metadata_size);
+    entry->value_size_ = static_cast<std::uint32_t>(value.size()) | (external ? Entry::external_bit : 0);
+    entry->key_size_ = static_cast<std::uint16_t>(key.size());
+    entry->eviction_bits_ = 0;
+    std::memcpy(entry->data(), key.data(), key.size());
+    std::memcpy(entry->data() + key.size(), value.data(), value.size());
+    return entry;
+}
+
+void HashStore::free_entry(Entry *entry)
+{
+    allocator.deallocate(metadata(*entry), block_size(entry->key_size_, entry->value_size()));
+}
+
+void HashStore::grow_if_needed()
+{
+    // At most 3/4 of the slots may be taken, tombstones included. A table that is full mostly of
+    // tombstones is rebuilt at the same size instead of growing.
+    if ((size_ + tombstones + 1) * 4 <= slots.size() * 3)
+        return;
+    rehash((size_ + 1) * 8 > slots.size() * 3 ? slots.size() * 2 : slots.size());
+}
+
+void HashStore::rehash(std::size_t slot_count)
+{
+    std::vector<Slot> old_slots(slot_count, Slot{empty_slot, nullptr});
+    old_slots.swap(slots);
+    shift = 64;
+    for (auto count = slot_count; count > 1; count >>= 1)
+        shift--;
+
+    auto mask = slots.size() - 1;
+    for (auto &slot : old_slots)
+    {
+        if (!slot.entry)
+            continue;
+        auto index = home_of(slot.hash);
+        while (slots[index].entry)
+            index = (index + 1) & mask;
+        slots[index] = slot;
+    }
+    tombstones = 0;
+}
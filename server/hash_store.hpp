@@ -0,0 +1,131 @@
+#ifndef HASH_STORE_HPP_
+#define HASH_STORE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "slab_allocator.hpp"
+
+// Open-addressing hash table from string keys to string values.
+//
+// Each slot holds the full 64-bit hash of its key next to a pointer to the entry, so a probe only touches
+// an entry whose hash matches. Key and value are stored inline, back to back, in one block from a slab
+// allocator. Lookups take a std::string_view and never build a std::string.
+//
+// Linear probing with tombstones: erasing an entry never moves another one, and an entry itself never moves
+// at all, so pointers to entries stay valid until they are erased; the ordered index and the eviction
+// policies keep such pointers. slot()/slot_count() give the eviction policies random and sweeping access
+// to the entries; the slot of an entry changes whenever the table is rehashed.
+//
+// An eviction policy can keep its bookkeeping with the entries: a few bits in every entry header, and
+// 'metadata_size' bytes in front of every entry.
+//
+// An entry can be marked external: its value is then a handle to data the owner keeps outside the store
+// (the shard keeps large values that way). The store copies and frees those bytes like any other value and
+// never looks at them, so the owner has to release what the handle refers to before it erases the entry.
+class HashStore
+{
+public:
+    class Entry
+    {
+        friend class HashStore;
+
+    private:
+        // The top bit of value_size_ marks an external entry.
+        static constexpr std::uint32_t external_bit = 0x80000000u;
+
+        std::uint32_t value_size_;
+        std::uint16_t key_size_;
+        mutable std::uint16_t eviction_bits_;
+
+        char *data() { return reinterpret_cast<char *>(this + 1); }
+        const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+        std::size_t value_size() const { return value_size_ & ~external_bit; }
+
+    public:
+        static constexpr std::size_t max_value_size = external_bit - 1;
+
+        std::string_view key() const { return std::string_view(data(), key_size_); }
+        std::string_view value() const { return std::string_view(data() + key_size_, value_size()); }
+        bool external() const { return (value_size_ & external_bit) != 0; }
+
+        std::uint16_t eviction_bits() const { return eviction_bits_; }
+        void set_eviction_bits(std::uint16_t bits) const { eviction_bits_ = bits; }
+    };
+
+private:
+    struct Slot
+    {
+        std::uint64_t hash;
+        Entry *entry;
+    };
+
+    // An empty slot has no entry and hash 'empty_slot'; a tombstone has no entry and hash 'erased_slot'.
+    static constexpr std::uint64_t empty_slot = 0;
+    static constexpr std::uint64_t erased_slot = 1;
+    static constexpr std::size_t min_slot_count = 16;
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    SlabAllocator allocator;
+    std::size_t metadata_size;
+    std::vector<Slot> slots;
+    std::size_t size_;
+    std::size_t tombstones;
+    unsigned shift;
+
+public:
+    explicit HashStore(std::size_t metadata_size = 0);
+    ~HashStore();
+
+    HashStore(const HashStore &) = delete;
+    HashStore &operator=(const HashStore &) = delete;
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const Entry *find(std::string_view key) const;
+    // Adds the entry unless the key is present already; returns the entry with that key and whether it was added.
+    std::pair<const Entry *, bool> insert(std::string_view key, std::string_view value, bool external = false);
+    void insert_or_assign(std::string_view key, std::string_view value);
+    bool erase(std::string_view key);
+    void erase(const Entry &entry);
+    void clear();
+    void reserve(std::size_t count);
+
+    std::size_t slot_count() const { return slots.size(); }
+    // The entry in slot 'index', or nullptr if the slot is free.
+    const Entry *slot(std::size_t index) const { return slots[index].entry; }
+
+    template <typename Function>
+    void for_each(Function function) const
+    {
+        for (auto &slot : slots)
+        {
+            if (slot.entry)
+                function(*slot.entry);
+        }
+    }
+
+    // The metadata_size bytes the eviction policy keeps for 'entry'.
+    void *metadata(const Entry &entry) const { return const_cast<char *>(reinterpret_cast<const char *>(&entry)) - metadata_size; }
+
+    // Exact heap bytes of one entry, and of the table without the entries.
+    std::size_t entry_bytes(const Entry &entry) const { return allocator.block_size(block_size(entry.key_size_, entry.value_size())); }
+    std::size_t table_bytes() const { return slots.capacity() * sizeof(Slot); }
+    // Bytes taken from the heap by the table and the entries, freed entries included.
+    std::size_t memory_usage() const { return table_bytes() + allocator.allocated_bytes(); }
+
+private:
+    static std::uint64_t hash_of(std::string_view key);
+    std::size_t block_size(std::size_t key_size, std::size_t value_size) const { return metadata_size + sizeof(Entry) + key_size + value_size; }
+    std::size_t home_of(std::uint64_t hash) const;
+    std::size_t find_slot(std::string_view key, std::uint64_t hash) const;
+    Entry *make_entry(std::string_view key, std::string_view value, bool external = false);
+    void free_entry(Entry *entry);
+    void grow_if_needed();
+    void rehash(std::size_t slot_count);
+};
+
+#endif // !HASH_STORE_HPP_
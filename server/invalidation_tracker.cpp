@@ -0,0 +1,89 @@
+#include <algorithm>
+#include "invalidation_tracker.hpp"
+
+void InvalidationTracker::track(std::string_view client, std::string_view key, Clock::time_point now)
+{
+    auto [client_it, added] = clients.try_emplace(std::string(client));
+    auto &reader = client_it->second;
+    if (added)
+        reader.identity = client_it->first;
+    reader.last_read = now;
+
+    auto it = holders.find(key);
+    if (it == holders.end())
+    {
+        if (holders.size() >= max_keys)
+            invalidate(read_order.front());
+        read_order.push_back(key);
+        it = holders.emplace(key, Holders{{}, std::prev(read_order.end())}).first;
+    }
+    else
+        read_order.splice(read_order.end(), read_order, it->second.position);
+    if (reader.keys.insert(key).second)
+        it->second.clients.push_back(&reader);
+}
+
+void InvalidationTracker::invalidate(std::string_view key)
+{
+    auto it = holders.find(key);
+    if (it == holders.end())
+        return;
+    for (auto client : it->second.clients)
+    {
+        client->keys.erase(key);
+        tell(*client, key);
+    }
+    read_order.erase(it->second.position);
+    holders.erase(it);
+}
+
+void InvalidationTracker::expire(Clock::time_point now)
+{
+    if (now < next_expiry)
+        return;
+    next_expiry = now + expiry_interval;
+
+    for (auto &[identity, client] : clients)
+    {
+        if (client.keys.empty() || now - client.last_read < idle_timeout)
+            continue;
+        for (auto key : client.keys)
+        {
+            auto it = holders.find(key);
+            auto &key_clients = it->second.clients;
+            key_clients.erase(std::find(key_clients.begin(), key_clients.end(), &client));
+            if (key_clients.empty())
+            {
+                read_order.erase(it->second.position);
+                holders.erase(it);
+            }
+            tell(client, key);
+        }
+        client.keys.clear();
+    }
+}
+
+void InvalidationTracker::take(std::vector<Push> &pushes)
+{
+    for (auto client : told)
+    {
+        auto message = net::encode_response(0, net::InvalidateData(std::vector<std::string_view>(client->invalidated.begin(), client->invalidated.end())));
+        pushes.push_back({zmq::message_t(client->identity.data(), client->identity.size()), std::move(message)});
+        client->invalidated.clear();
+    }
+    // Clients that hold no keys any more are forgotten; they are added again by their next read.
+    for (auto client : told)
+    {
+        if (client->keys.empty())
+            clients.erase(std::string(client->identity));
+    }
+    told.clear();
+}
+
+void InvalidationTracker::tell(Client &client, std::string_view key)
+{
+    if (client.invalidated.empty())
+        told.push_back(&client);
+    client.invalidated.emplace_back(key);
+    invalidation_count++;
+}
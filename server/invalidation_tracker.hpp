@@ -0,0 +1,88 @@
+#ifndef INVALIDATION_TRACKER_HPP_
+#define INVALIDATION_TRACKER_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "cpp_helpers/network_message.hpp"
+
+// Which clients read which keys with TRACKED_GET, so they can be told once the value they hold is gone.
+//
+// Keys are tracked by views of the store's entry keys: a key is only tracked while its entry exists, and
+// the owner calls invalidate() before the entry is erased. Clients are known by their socket identity and
+// forgotten once they hold no keys. A client is told once per key; it has to read the key again to be told
+// again. A client that has not read with TRACKED_GET for idle_timeout is told to drop all its keys, so
+// clients that went away do not keep keys tracked forever. When more than max_keys keys are tracked,
+// tracking an additional one invalidates the least recently read key early, which only costs its holders
+// a round trip.
+class InvalidationTracker
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // A message for one client: its identity and the INVALIDATE push.
+    struct Push
+    {
+        zmq::message_t identity;
+        zmq::message_t message;
+    };
+
+private:
+    static constexpr std::size_t max_keys = 1 << 20;
+    static constexpr Clock::duration idle_timeout = std::chrono::minutes(5);
+    static constexpr Clock::duration expiry_interval = std::chrono::seconds(1);
+
+    struct Client
+    {
+        // A view of its key in 'clients'.
+        std::string_view identity;
+        std::unordered_set<std::string_view> keys;
+        // Keys to tell it about, since the last take().
+        std::vector<std::string> invalidated;
+        Clock::time_point last_read;
+    };
+
+    struct Holders
+    {
+        std::vector<Client *> clients;
+        std::list<std::string_view>::iterator position;
+    };
+
+    // By identity; the addresses of the clients do not change.
+    std::unordered_map<std::string, Client> clients;
+    std::unordered_map<std::string_view, Holders> holders;
+    // The tracked keys, least recently read first.
+    std::list<std::string_view> read_order;
+    // The clients with invalidated keys, since the last take().
+    std::vector<Client *> told;
+    Clock::time_point next_expiry;
+    std::uint64_t invalidation_count;
+
+public:
+    InvalidationTracker() : invalidation_count(0) {}
+
+    bool empty() const { return holders.empty(); }
+    std::size_t tracked_keys() const { return holders.size(); }
+    std::size_t tracking_clients() const { return clients.size(); }
+    // Keys invalidated so far, counted once per client told.
+    std::uint64_t invalidations() const { return invalidation_count; }
+
+    // 'key' must be the key of an entry of the store.
+    void track(std::string_view client, std::string_view key, Clock::time_point now = Clock::now());
+    void invalidate(std::string_view key);
+    // Invalidates all keys of the clients idle for idle_timeout; checks at most once per expiry_interval.
+    void expire(Clock::time_point now = Clock::now());
+    // Appends one INVALIDATE push per client with invalidated keys.
+    void take(std::vector<Push> &pushes);
+
+private:
+    void tell(Client &client, std::string_view key);
+};
+
+#endif // !INVALIDATION_TRACKER_HPP_
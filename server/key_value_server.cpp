@@ -1,117 +1,349 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include "key_value_server.hpp"
+#include "cpp_helpers/logger.hpp"
 #include "cpp_helpers/network_message.hpp"
 
-KeyValueServer::KeyValueServer(std::uint16_t port)
-    : key_value_size(0),
-      socket(std::make_unique<net::Server>(net::TCP, port))
+namespace
+{
+// The memory limit is split evenly: keys spread evenly over the shards.
+EvictionOptions shard_eviction_options(const ServerOptions &options)
+{
+    auto eviction = options.eviction;
+    if (eviction.enabled())
+        eviction.max_memory = std::max<std::size_t>(eviction.max_memory / options.threads, 1);
+    return eviction;
+}
+
+// Replicas tell a restarted primary by its epoch: the time it started.
+ReplicationOptions replication_options(const ServerOptions &options)
+{
+    auto replication = options.replication;
+    if (replication.publishes())
+        replication.epoch = static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+    return replication;
+}
+} // namespace
+
+KeyValueServer::KeyValueServer(const ServerOptions &options)
+    : KeyValueServer(options, replication_options(options))
 {
 }
 
+KeyValueServer::KeyValueServer(const ServerOptions &options, const ReplicationOptions &replication)
+    : socket(std::make_unique<net::Server>(options.endpoints.at(0))),
+      next_ticket(0),
+      stopping(false)
+{
+    for (std::size_t i = 1; i < options.endpoints.size(); i++)
+        socket->bind(options.endpoints[i]);
+
+    if (replication.publishes())
+        publisher = std::make_unique<ReplicationPublisher>(replication);
+    else if (replication.replica())
+        subscriber = std::make_unique<ReplicationSubscriber>(replication);
+
+    if (options.threads > 1)
+    {
+        for (std::size_t i = 0; i < options.threads; i++)
+            workers.push_back(std::make_unique<ShardWorker>(i, options.threads, options.persistence, shard_eviction_options(options), replication));
+        for (auto &worker : workers)
+            worker->wait_until_ready();
+    }
+    else
+    {
+        local_shard = std::make_unique<KeyValueShard>(0, 1, options.persistence, shard_eviction_options(options), replication);
+        local_shard->recover();
+    }
+}
+
 KeyValueServer::~KeyValueServer()
 {
 }
 
+void KeyValueServer::run(const volatile std::sig_atomic_t &signal_status)
+{
+    std::vector<zmq::pollitem_t> items{{socket->handle(), 0, ZMQ_POLLIN, 0}};
+    for (auto &worker : workers)
+        items.push_back({worker->handle(), 0, ZMQ_POLLIN, 0});
+    if (subscriber)
+    {
+        items.push_back({subscriber->stream_handle(), 0, ZMQ_POLLIN, 0});
+        items.push_back({subscriber->primary_handle(), 0, ZMQ_POLLIN, 0});
+    }
+
+    while (signal_status == 0 && !stopping)
+    {
+        auto ready = net::poll(items.data(), items.size(), workers.empty() ? local_shard->poll_timeout_ms(poll_timeout_ms) : poll_timeout_ms);
+        if (ready && (items[0].revents & ZMQ_POLLIN))
+        {
+            if (workers.empty())
+                handle_requests();
+            else
+                forward_requests();
+        }
+        for (std::size_t i = 0; i < workers.size(); i++)
+        {
+            if (ready && (items[i + 1].revents & ZMQ_POLLIN))
+                forward_replies(i);
+        }
+        // The subscriber also has timeouts to look after, so it is asked even when nothing arrived.
+        if (subscriber)
+            apply_replication();
+        if (workers.empty())
+        {
+            local_shard->tick();
+            publish(local_shard->take_replication_batch());
+            // Clients whose tracking expired are told to drop their cached keys.
+            take_invalidations();
+            flush_replies();
+        }
+    }
+    if (workers.empty())
+        local_shard->print_stats();
+}
+
+void KeyValueServer::run()
+{
+    volatile std::sig_atomic_t no_signal = 0;
+    run(no_signal);
+}
+
 void KeyValueServer::handle_requests()
 {
-    std::string identity;
-    std::stringstream stream;
-    if (socket->receive(identity, stream))
+    if (!workers.empty())
+    {
+        forward_requests();
+        for (std::size_t shard = 0; shard < workers.size(); shard++)
+            forward_replies(shard);
+        return;
+    }
+
+    for (std::size_t handled = 0; handled < max_batch_size; handled++)
+    {
+        zmq::message_t identity, request;
+        net::Frames frames;
+        if (!socket->receive(identity, request, frames))
+            break;
+        handle_request(identity, request, frames);
+    }
+    local_shard->commit();
+    publish(local_shard->take_replication_batch());
+    take_invalidations();
+    flush_replies();
+}
+
+void KeyValueServer::handle_request(zmq::message_t &identity, const zmq::message_t &request, net::Frames &frames)
+{
+    if (reject_write(identity, request))
+        return;
+    zmq::message_t reply;
+    net::Frames reply_frames;
+    if (local_shard->handle_request(identity, request, frames, reply, reply_frames))
+    {
+        add_replication_stats(reply);
+        pending_replies.push_back({std::move(identity), std::move(reply), std::move(reply_frames)});
+    }
+}
+
+void KeyValueServer::forward_requests()
+{
+    for (std::size_t handled = 0; handled < max_batch_size; handled++)
     {
-        if (net::SendMessage header; stream >> header)
+        zmq::message_t identity, request;
+        net::Frames frames;
+        if (!socket->receive(identity, request, frames))
+            break;
+        if (reject_write(identity, request))
+            continue;
+
+        // Batches carry no value frames; any sent with one are dropped.
+        net::NetworkCommand command;
+        if (!net::peek_command_type(request.data(), request.size(), command) || !net::is_broadcast_command(command))
         {
-            switch (header.data_type)
-            {
-            case static_cast<std::underlying_type<net::NetworkCommand>::type>(net::NetworkCommand::PUT_COMMAND):
-            {
-                if (net::PutCommand cmd; stream >> cmd)
-                {
-                    std::stringstream stream;
-                    if (key_value_store.find(cmd.key) == key_value_store.end())
-                    {
-                        key_value_store[cmd.key] = cmd.value;
-                        std::cout << "A request for adding an item '" << cmd.key << ": " << cmd.value << "' was received." << std::endl;
-                        auto response_data = net::KeyAddedResponseData(cmd.key, cmd.value);
-                        stream << net::ResponseMessage(header.id, response_data.type()) << response_data;
-                        socket->send(identity, stream.str());
-                        print_key_value();
-                    }
-                    else
-                    {
-                        std::cout << "A request for adding an already existing item '" << cmd.key << ": " << cmd.value << "' was received." << std::endl;
-                        auto response_data = net::KeyAlreadyExistResponseData(cmd.key);
-                        stream << net::ResponseMessage(header.id, response_data.type()) << response_data;
-                        socket->send(identity, stream.str());
-                    }
-                }
-                break;
-            }
-            case static_cast<std::underlying_type<net::NetworkCommand>::type>(net::NetworkCommand::GET_COMMAND):
-            {
-                if (net::GetCommand cmd; stream >> cmd)
-                {
-                    std::stringstream stream;
-                    if (key_value_store.find(cmd.key) != key_value_store.end())
-                    {
-                        std::cout << "A request for value of the key '" << cmd.key << "' was received." << std::endl;
-                        auto response_data = net::KeyValueResponseData(cmd.key, key_value_store[cmd.key]);
-                        stream << net::ResponseMessage(header.id, response_data.type()) << response_data;
-                        socket->send(identity, stream.str());
-                        print_key_value();
-                    }
-                    else
-                    {
-                        std::cout << "A request for value of an unknown key '" << cmd.key << "' was received." << std::endl;
-                        auto response_data = net::KeyNotExistResponseData(cmd.key);
-                        stream << net::ResponseMessage(header.id, response_data.type()) << response_data;
-                        socket->send(identity, stream.str());
-                    }
-                }
-                break;
-            }
-            case static_cast<std::underlying_type<net::NetworkCommand>::type>(net::NetworkCommand::DELETE_COMMAND):
-            {
-                if (net::DeleteCommand cmd; stream >> cmd)
-                {
-                    std::stringstream stream;
-                    if (key_value_store.find(cmd.key) != key_value_store.end())
-                    {
-                        key_value_store.erase(cmd.key);
-                        std::cout << "A request for removing an item with key '" << cmd.key << "' was received." << std::endl;
-                        auto response_data = net::KeyDeletedResponseData(cmd.key);
-                        stream << net::ResponseMessage(header.id, response_data.type()) << response_data;
-                        socket->send(identity, stream.str());
-                        print_key_value();
-                    }
-                    else
-                    {
-                        std::cout << "A request for removing an unknown item with key '" << cmd.key << "' was received." << std::endl;
-                        auto response_data = net::KeyNotExistResponseData(cmd.key);
-                        stream << net::ResponseMessage(header.id, response_data.type()) << response_data;
-                        socket->send(identity, stream.str());
-                    }
-                }
-                break;
-            }
-
-            default:
-                break;
-            }
+            zmq::message_t ticket;
+            workers[shard_of(request)]->forward(ticket, identity, request, frames);
         }
+        else if (net::is_multi_key_command(command))
+            split_request(identity, request);
+        else
+            scatter_request(identity, request);
+    }
+}
+
+void KeyValueServer::split_request(zmq::message_t &identity, zmq::message_t &request)
+{
+    std::vector<zmq::message_t> requests;
+    std::vector<std::vector<std::uint32_t>> positions;
+    if (!KeyValueShard::split_batch(request, workers.size(), requests, positions))
+        return;
+
+    net::Frames no_frames;
+    auto shards = std::count_if(positions.begin(), positions.end(), [](auto &keys) { return !keys.empty(); });
+    if (shards <= 1)
+    {
+        // A batch within a single shard (or an empty one) is answered by that shard alone.
+        auto owner = std::find_if(positions.begin(), positions.end(), [](auto &keys) { return !keys.empty(); });
+        zmq::message_t ticket;
+        workers[owner == positions.end() ? 0 : owner - positions.begin()]->forward(ticket, identity, request, no_frames);
+        return;
+    }
+
+    auto ticket_value = next_ticket++;
+    for (std::size_t shard = 0; shard < workers.size(); shard++)
+    {
+        if (positions[shard].empty())
+            continue;
+        zmq::message_t ticket(&ticket_value, sizeof(ticket_value));
+        zmq::message_t worker_identity;
+        worker_identity.copy(&identity);
+        workers[shard]->forward(ticket, worker_identity, requests[shard], no_frames);
+    }
+    auto &gather = pending_gathers[ticket_value];
+    gather.identity = std::move(identity);
+    gather.parts.resize(workers.size());
+    gather.positions = std::move(positions);
+    gather.waiting = shards;
+}
+
+void KeyValueServer::scatter_request(zmq::message_t &identity, zmq::message_t &request)
+{
+    auto ticket_value = next_ticket++;
+    for (auto &worker : workers)
+    {
+        zmq::message_t ticket(&ticket_value, sizeof(ticket_value));
+        zmq::message_t worker_identity, worker_request;
+        worker_identity.copy(&identity);
+        worker_request.copy(&request);
+        net::Frames no_frames;
+        worker->forward(ticket, worker_identity, worker_request, no_frames);
+    }
+    auto &gather = pending_gathers[ticket_value];
+    gather.identity = std::move(identity);
+    gather.parts.resize(workers.size());
+    gather.waiting = workers.size();
+}
+
+void KeyValueServer::forward_replies(std::size_t shard)
+{
+    auto &worker = *workers[shard];
+    for (std::size_t handled = 0; handled < max_batch_size; handled++)
+    {
+        zmq::message_t ticket, identity, reply;
+        net::Frames frames;
+        if (!worker.receive(ticket, identity, reply, frames))
+            break;
+        if (identity.size() == 0)
+            publish(std::move(reply));
+        else if (ticket.size() == 0)
+            socket->send(identity, reply, frames);
+        else
+            gather_reply(shard, ticket, reply);
+    }
+}
+
+void KeyValueServer::gather_reply(std::size_t shard, const zmq::message_t &ticket, zmq::message_t &reply)
+{
+    std::uint64_t ticket_value;
+    std::memcpy(&ticket_value, ticket.data(), sizeof(ticket_value));
+    auto it = pending_gathers.find(ticket_value);
+    if (it == pending_gathers.end())
+        return;
+
+    auto &gather = it->second;
+    gather.parts[shard] = std::move(reply);
+    if (--gather.waiting > 0)
+        return;
+
+    auto merged = gather.positions.empty() ? KeyValueShard::merge_partial_replies(gather.parts)
+                                           : KeyValueShard::merge_batch_replies(gather.parts, gather.positions);
+    if (merged.size() > 0)
+    {
+        add_replication_stats(merged);
+        socket->send(gather.identity, merged);
     }
+    pending_gathers.erase(it);
+}
+
+std::size_t KeyValueServer::shard_of(const zmq::message_t &request) const
+{
+    // Requests without a readable key all go to the first shard, which drops them.
+    if (std::string_view key; net::peek_command_key(request.data(), request.size(), key))
+        return KeyValueShard::shard_of(key, workers.size());
+    return 0;
+}
+
+void KeyValueServer::take_invalidations()
+{
+    std::vector<InvalidationTracker::Push> pushes;
+    local_shard->take_invalidations(pushes);
+    for (auto &push : pushes)
+        pending_replies.push_back({std::move(push.identity), std::move(push.message), {}});
 }
 
-double KeyValueServer::item_size(const std::pair<std::string, std::string> &item)
+void KeyValueServer::flush_replies()
 {
-    return (item.first.size() / 1024.0 / 1024.0) + (item.second.size() / 1024.0 / 1024.0);
+    for (auto &reply : pending_replies)
+        socket->send(reply.identity, reply.data, reply.frames);
+    pending_replies.clear();
 }
 
+// A replica answers writes itself, with READ_ONLY.
+bool KeyValueServer::reject_write(zmq::message_t &identity, const zmq::message_t &request)
+{
+    net::NetworkCommand command;
+    if (!subscriber || !net::peek_command_type(request.data(), request.size(), command) || !net::is_write_command(command))
+        return false;
+    codec::Reader reader(request.data(), request.size());
+    net::SendMessage header;
+    header.decode(reader);
+    auto reply = net::encode_response(header.id, net::ReadOnlyResponseData());
+    socket->send(identity, reply);
+    return true;
+}
 
-void KeyValueServer::print_key_value()
+void KeyValueServer::publish(zmq::message_t batch)
 {
-    std::cout << "Store status:" << '\n';
-    for(auto&[key, value] : key_value_store)
+    if (publisher && batch.size() > 0)
+        publisher->publish(batch);
+}
+
+void KeyValueServer::apply_replication()
+{
+    std::vector<zmq::message_t> batches;
+    subscriber->receive(batches);
+    for (auto &batch : batches)
     {
-        std::cout << "\tItem: " << key << ": " << value << '\n';
+        if (workers.empty())
+        {
+            if (!local_shard->apply_replication_batch(batch))
+                logging::warning("A malformed replication batch was dropped.");
+            take_invalidations();
+            flush_replies();
+            continue;
+        }
+        // Every worker applies the mutations of its own keys.
+        for (auto &worker : workers)
+        {
+            zmq::message_t ticket, identity, worker_batch;
+            worker_batch.copy(&batch);
+            net::Frames no_frames;
+            worker->forward(ticket, identity, worker_batch, no_frames);
+        }
     }
-    std::cout << std::endl;
-}
\ No newline at end of file
+}
+
+// The shards know nothing about replication, so a replica adds its metrics to their STATS reply.
+void KeyValueServer::add_replication_stats(zmq::message_t &reply) const
+{
+    if (!subscriber)
+        return;
+    codec::Reader reader(reply.data(), reply.size());
+    net::ResponseMessage header;
+    net::StatsResponseData stats;
+    if (!header.decode(reader) || static_cast<net::NetworkResponse>(header.data_type) != net::NetworkResponse::STATS || !stats.decode(reader))
+        return;
+    auto text = std::string(stats.text) + subscriber->stats_text();
+    reply = net::encode_response(header.id, net::StatsResponseData(text));
+}
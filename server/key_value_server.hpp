@@ -1,28 +1,84 @@
 #ifndef KEY_VALUE_SERVER_HPP_
 #define KEY_VALUE_SERVER_HPP_
 
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <csignal>
 #include <unordered_map>
+#include <vector>
 #include "cpp_helpers/networking.hpp"
+#include "key_value_shard.hpp"
+#include "replication.hpp"
+#include "server_options.hpp"
+#include "shard_worker.hpp"
 
 class KeyValueServer
 {
 private:
-    double key_value_size;
-    std::unordered_map<std::string, std::string> key_value_store;
+    struct Reply
+    {
+        zmq::message_t identity;
+        zmq::message_t data;
+        net::Frames frames;
+    };
+
+    // A request sent to several shards, waiting for their partial replies.
+    struct PendingGather
+    {
+        zmq::message_t identity;
+        // The replies, indexed by shard; the replies of a split batch are reassembled by 'positions'.
+        std::vector<zmq::message_t> parts;
+        std::vector<std::vector<std::uint32_t>> positions;
+        std::size_t waiting = 0;
+    };
+
+    // Upper bound on the messages handled per wake-up, so one busy client cannot delay the replies of a batch forever.
+    static constexpr std::size_t max_batch_size = 4096;
+    // The poll timeout only bounds how long a SIGINT may go unnoticed when the wait is not interrupted by it.
+    static constexpr long poll_timeout_ms = 100;
+
     std::unique_ptr<net::Server> socket;
+    // One of the two is set on a primary and on a replica, respectively.
+    std::unique_ptr<ReplicationPublisher> publisher;
+    std::unique_ptr<ReplicationSubscriber> subscriber;
+    // Set only when the server runs single-threaded; otherwise every shard lives in its own worker.
+    std::unique_ptr<KeyValueShard> local_shard;
+    std::vector<std::unique_ptr<ShardWorker>> workers;
+    std::vector<Reply> pending_replies;
+    std::unordered_map<std::uint64_t, PendingGather> pending_gathers;
+    std::uint64_t next_ticket;
+    std::atomic<bool> stopping;
 
 public:
-    KeyValueServer(std::uint16_t port);
+    KeyValueServer(const ServerOptions &options);
     ~KeyValueServer();
 
+    // Serves until 'signal_status' is set by a signal handler or stop() is called.
+    void run(const volatile std::sig_atomic_t &signal_status);
+    void run();
+    // Ends run() from any thread, within one poll timeout.
+    void stop() { stopping = true; }
+    // The endpoint bound last, with the port the system picked for a "tcp://host:*" endpoint.
+    std::string last_endpoint() const { return socket->last_endpoint(); }
     void handle_requests();
 
 private:
-    double item_size(const std::pair<std::string, std::string> &item);
-    void print_key_value();
+    // 'replication' is computed once, so the local shard, the workers and the publisher share one epoch.
+    KeyValueServer(const ServerOptions &options, const ReplicationOptions &replication);
+    void handle_request(zmq::message_t &identity, const zmq::message_t &request, net::Frames &frames);
+    void forward_requests();
+    void split_request(zmq::message_t &identity, zmq::message_t &request);
+    void scatter_request(zmq::message_t &identity, zmq::message_t &request);
+    void forward_replies(std::size_t shard);
+    void gather_reply(std::size_t shard, const zmq::message_t &ticket, zmq::message_t &reply);
+    std::size_t shard_of(const zmq::message_t &request) const;
+    void take_invalidations();
+    void flush_replies();
+    bool reject_write(zmq::message_t &identity, const zmq::message_t &request);
+    void publish(zmq::message_t batch);
+    void apply_replication();
+    void add_replication_stats(zmq::message_t &reply) const;
 };
 
 #endif // !KEY_VALUE_SERVER_HPP_
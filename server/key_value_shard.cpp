@@ -0,0 +1,819 @@
+#include <algorithm>
+#include <deque>
+#include <sstream>
+#include <stdexcept>
+#include "cpp_helpers/logger.hpp"
+#include "key_value_shard.hpp"
+
+namespace
+{
+const LargeValue &large_value(const HashStore::Entry &item)
+{
+    return *LargeValue::from_handle(item.value());
+}
+
+std::size_t total_size(const net::Frames &frames)
+{
+    std::size_t size = 0;
+    for (auto &frame : frames)
+        size += frame.size();
+    return size;
+}
+
+std::uint32_t page_limit(std::uint32_t limit)
+{
+    return limit == 0 || limit > net::max_scan_limit ? net::max_scan_limit : limit;
+}
+
+std::string_view key_of(std::string_view key) { return key; }
+std::string_view key_of(const std::pair<std::string_view, std::string_view> &item) { return item.first; }
+std::vector<std::string_view> &items_of(net::MultiKeyData &batch) { return batch.keys; }
+std::vector<std::pair<std::string_view, std::string_view>> &items_of(net::MultiKeyValueData &batch) { return batch.items; }
+
+// A MULTI_PUT with a value the log could not hold is refused whole, before any shard stores a part of it.
+bool refused(const net::MultiKeyData &) { return false; }
+bool refused(const net::MultiKeyValueData &batch)
+{
+    return std::any_of(batch.items.begin(), batch.items.end(),
+                       [](auto &item) { return item.second.size() > net::max_value_size; });
+}
+
+template <typename Command>
+bool split_items(codec::Reader &reader, net::RequestId id, std::size_t count, std::vector<zmq::message_t> &requests,
+                 std::vector<std::vector<std::uint32_t>> &positions)
+{
+    Command batch;
+    if (!batch.decode(reader) || refused(batch))
+        return false;
+    std::vector<Command> parts(count);
+    auto &items = items_of(batch);
+    for (std::uint32_t position = 0; position < items.size(); position++)
+    {
+        auto shard = KeyValueShard::shard_of(key_of(items[position]), count);
+        items_of(parts[shard]).push_back(items[position]);
+        positions[shard].push_back(position);
+    }
+    for (std::size_t shard = 0; shard < count; shard++)
+    {
+        if (!positions[shard].empty())
+            requests[shard] = net::encode_command(id, parts[shard]);
+    }
+    return true;
+}
+
+// Copies the per-key results of the shards' replies to their positions in 'merged'.
+template <typename Response, typename Result>
+bool merge_items(const std::vector<zmq::message_t> &parts, const std::vector<std::vector<std::uint32_t>> &positions,
+                 std::vector<Result> Response::*items, net::ResponseMessage &header, Response &merged)
+{
+    std::size_t size = 0;
+    for (auto &shard_positions : positions)
+        size += shard_positions.size();
+    (merged.*items).resize(size);
+
+    // The merged results point into 'parts', which outlive the encoding of 'merged'.
+    for (std::size_t shard = 0; shard < parts.size(); shard++)
+    {
+        if (positions[shard].empty())
+            continue;
+        codec::Reader reader(parts[shard].data(), parts[shard].size());
+        Response partial;
+        if (!header.decode(reader) || header.data_type != static_cast<std::uint8_t>(Response::type()) || !partial.decode(reader) ||
+            (partial.*items).size() != positions[shard].size())
+            return false;
+        for (std::size_t i = 0; i < positions[shard].size(); i++)
+            (merged.*items)[positions[shard][i]] = (partial.*items)[i];
+    }
+    return true;
+}
+} // namespace
+
+KeyValueShard::KeyValueShard(std::size_t index, std::size_t count, const PersistenceOptions &persistence_options,
+                             const EvictionOptions &eviction_options, const ReplicationOptions &replication_options)
+    : index(index),
+      count(count),
+      key_value_size(0),
+      max_memory(eviction_options.max_memory),
+      key_value_store(eviction_options.enabled() ? EvictionPolicy::metadata_size(eviction_options.policy) : 0),
+      command_latency(net::command_count),
+      recovering(false),
+      snapshotting(false),
+      snapshot_after_cursor(false)
+{
+    if (eviction_options.enabled())
+    {
+        // The limit bounds the entries; the table and the index come on top, and a limit below what they take
+        // empty would only ever hold a handful of keys.
+        if (max_memory < memory_usage())
+            throw std::invalid_argument("the memory limit of a shard (" + std::to_string(max_memory) + " bytes) is below the " +
+                                        std::to_string(memory_usage()) + " bytes its empty table takes");
+        eviction = EvictionPolicy::create(eviction_options.policy, key_value_store);
+    }
+    if (persistence_options.enabled())
+        persistence = std::make_unique<Persistence>(persistence_options, index, count);
+    if (replication_options.publishes())
+        replication = std::make_unique<ReplicationLog>(replication_options, index, count);
+}
+
+KeyValueShard::~KeyValueShard()
+{
+    key_value_store.for_each([](const HashStore::Entry &item) {
+        if (item.external())
+            LargeValue::from_handle(item.value())->release();
+    });
+}
+
+void KeyValueShard::recover()
+{
+    if (!persistence)
+        return;
+    // Entries evicted while the data is loaded are not logged: the old log is replayed, not appended to.
+    recovering = true;
+    persistence->recover(
+        [this](std::string_view key, std::string_view value)
+        {
+            remove_item(key);
+            add_item(key, value);
+            evict_if_needed();
+        },
+        [this](std::string_view key) { remove_item(key); });
+    recovering = false;
+    logging::info("Shard ", index, " recovered ", key_value_store.size(), " items.");
+}
+
+void KeyValueShard::commit()
+{
+    if (persistence)
+        persistence->commit();
+}
+
+void KeyValueShard::tick()
+{
+    invalidations.expire();
+    if (!persistence)
+        return;
+    persistence->tick();
+    if (!snapshotting && persistence->snapshot_due())
+    {
+        persistence->begin_snapshot();
+        snapshotting = true;
+        snapshot_cursor.clear();
+        snapshot_after_cursor = false;
+    }
+    if (snapshotting)
+        continue_snapshot();
+}
+
+long KeyValueShard::poll_timeout_ms(long idle_ms)
+{
+    if (!snapshotting)
+        return idle_ms;
+    // The writer thread drains a backlog on its own; spinning would not speed it up.
+    return persistence->snapshot_backlogged() ? 1 : 0;
+}
+
+void KeyValueShard::continue_snapshot()
+{
+    // The walk goes in key order and resumes after the last key written, so neither rehashes nor the
+    // entries added and removed between ticks make it start over. Keys added behind it, and changes to
+    // keys already written, are in the log since the snapshot began, which is replayed over it.
+    std::size_t written = 0;
+    bool done = true;
+    const HashStore::Entry *last = nullptr;
+    ordered_index.scan(snapshot_cursor, snapshot_after_cursor,
+        [&](const HashStore::Entry &entry)
+        {
+            if (written == snapshot_entries_per_tick || persistence->snapshot_backlogged())
+            {
+                done = false;
+                return false;
+            }
+            if (entry.external())
+                persistence->snapshot_entry(entry.key(), large_value(entry).chunk_views());
+            else
+                persistence->snapshot_entry(entry.key(), entry.value());
+            last = &entry;
+            written++;
+            return true;
+        });
+    if (last)
+    {
+        snapshot_cursor = last->key();
+        snapshot_after_cursor = true;
+    }
+    if (done)
+    {
+        persistence->end_snapshot();
+        snapshotting = false;
+    }
+}
+
+zmq::message_t KeyValueShard::take_replication_batch()
+{
+    return replication ? replication->take_batch() : zmq::message_t();
+}
+
+bool KeyValueShard::apply_replication_batch(const zmq::message_t &message)
+{
+    codec::Reader reader(message.data(), message.size());
+    net::ReplicationBatch batch;
+    if (!batch.decode(reader))
+        return false;
+    if (batch.header.flags & net::replication_reset)
+        clear_items();
+    // A PUT replaces the value, whatever the replica holds; the primary only sends it for a new key.
+    for (auto &mutation : batch.mutations)
+    {
+        if (!owns(mutation.key))
+            continue;
+        remove_item(mutation.key);
+        if (mutation.type == net::MutationType::PUT_MUTATION)
+        {
+            add_item(mutation.key, mutation.value);
+            evict_if_needed();
+        }
+    }
+    return true;
+}
+
+bool KeyValueShard::handle_request(const zmq::message_t &identity, const zmq::message_t &request, net::Frames &value_frames, zmq::message_t &reply,
+                                   net::Frames &reply_frames)
+{
+    auto start = TimeStamp::now();
+    net::NetworkCommand command;
+    std::string_view client(static_cast<const char *>(identity.data()), identity.size());
+    if (!dispatch_request(client, request, value_frames, reply, reply_frames, command))
+    {
+        stats_.bad_requests++;
+        return false;
+    }
+    command_latency[static_cast<std::size_t>(command)].record(TimeStamp::now() - start);
+    return true;
+}
+
+bool KeyValueShard::dispatch_request(std::string_view client, const zmq::message_t &request, net::Frames &value_frames, zmq::message_t &reply,
+                                     net::Frames &reply_frames, net::NetworkCommand &command)
+{
+    codec::Reader reader(request.data(), request.size());
+    net::SendMessage header;
+    if (!header.decode(reader))
+        return false;
+
+    command = static_cast<net::NetworkCommand>(header.data_type);
+    switch (command)
+    {
+    case net::NetworkCommand::PUT_COMMAND:
+    {
+        net::PutCommand cmd;
+        if (!cmd.decode(reader))
+            return false;
+        // A value sent in frames leaves the inline value empty.
+        auto value_size = value_frames.empty() ? cmd.value.size() : total_size(value_frames);
+        if ((!value_frames.empty() && !cmd.value.empty()) || value_size > net::max_value_size)
+            return false;
+        if (auto item = value_frames.empty() ? add_item(cmd.key, cmd.value) : add_item(cmd.key, value_frames))
+        {
+            log_put(*item);
+            logging::debug("A request for adding an item '", cmd.key, "' of ", value_size, " bytes was received.");
+            reply = net::encode_response(header.id, net::KeyAddedResponseData(cmd.key));
+            evict_if_needed();
+        }
+        else
+        {
+            logging::debug("A request for adding an already existing item '", cmd.key, "' was received.");
+            reply = net::encode_response(header.id, net::KeyAlreadyExistResponseData(cmd.key));
+        }
+        return true;
+    }
+    case net::NetworkCommand::GET_COMMAND:
+    case net::NetworkCommand::TRACKED_GET_COMMAND:
+    {
+        net::GetCommand cmd;
+        if (!cmd.decode(reader))
+            return false;
+        if (auto entry = find_item(cmd.key))
+        {
+            logging::debug("A request for value of the key '", cmd.key, "' was received.");
+            if (command == net::NetworkCommand::TRACKED_GET_COMMAND)
+                invalidations.track(client, entry->key());
+            if (entry->external())
+            {
+                reply = net::encode_response(header.id, net::KeyValueResponseData(cmd.key, {}));
+                LargeValue::from_handle(entry->value())->append_frames(reply_frames);
+            }
+            else
+                reply = net::encode_response(header.id, net::KeyValueResponseData(cmd.key, entry->value()));
+        }
+        else
+        {
+            logging::debug("A request for value of an unknown key '", cmd.key, "' was received.");
+            reply = net::encode_response(header.id, net::KeyNotExistResponseData(cmd.key));
+        }
+        return true;
+    }
+    case net::NetworkCommand::DELETE_COMMAND:
+    {
+        net::DeleteCommand cmd;
+        if (!cmd.decode(reader))
+            return false;
+        if (remove_item(cmd.key))
+        {
+            log_delete(cmd.key);
+            logging::debug("A request for removing an item with key '", cmd.key, "' was received.");
+            reply = net::encode_response(header.id, net::KeyDeletedResponseData(cmd.key));
+        }
+        else
+        {
+            logging::debug("A request for removing an unknown item with key '", cmd.key, "' was received.");
+            reply = net::encode_response(header.id, net::KeyNotExistResponseData(cmd.key));
+        }
+        return true;
+    }
+    case net::NetworkCommand::MULTI_PUT_COMMAND:
+        handle_multi_put(header.id, reader, reply);
+        return reply.size() > 0;
+    case net::NetworkCommand::MULTI_GET_COMMAND:
+        handle_multi_get(header.id, reader, reply);
+        return reply.size() > 0;
+    case net::NetworkCommand::MULTI_DELETE_COMMAND:
+        handle_multi_delete(header.id, reader, reply);
+        return reply.size() > 0;
+    case net::NetworkCommand::STATS_COMMAND:
+        reply = net::encode_response(header.id, net::StatsResponseData(stats_text()));
+        return true;
+    case net::NetworkCommand::SCAN_COMMAND:
+    {
+        net::ScanCommand cmd;
+        if (!cmd.decode(reader))
+            return false;
+        handle_scan(header.id, cmd.start, cmd.end, cmd.cursor, cmd.limit, cmd.flags, reply);
+        return true;
+    }
+    case net::NetworkCommand::PREFIX_SCAN_COMMAND:
+    {
+        net::PrefixScanCommand cmd;
+        if (!cmd.decode(reader))
+            return false;
+        handle_scan(header.id, cmd.prefix, prefix_end(cmd.prefix), cmd.cursor, cmd.limit, cmd.flags, reply);
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+void KeyValueShard::handle_multi_put(net::RequestId id, codec::Reader &reader, zmq::message_t &reply)
+{
+    net::MultiPutCommand cmd;
+    if (!cmd.decode(reader))
+        return;
+
+    // A batch with a value the log could not hold is refused whole, before any of it is stored.
+    for (auto &item : cmd.items)
+    {
+        if (item.second.size() > net::max_value_size)
+            return;
+    }
+
+    logging::debug("A request for adding ", cmd.items.size(), " items was received.");
+    net::MultiStatusResponseData response;
+    response.statuses.reserve(cmd.items.size());
+    for (auto &[key, value] : cmd.items)
+    {
+        if (auto item = add_item(key, value))
+        {
+            log_put(*item);
+            response.statuses.push_back(net::NetworkResponse::KEY_ADDED);
+            evict_if_needed();
+        }
+        else
+            response.statuses.push_back(net::NetworkResponse::KEY_ALREADY_EXIST);
+    }
+    reply = net::encode_response(id, response);
+}
+
+void KeyValueShard::handle_multi_get(net::RequestId id, codec::Reader &reader, zmq::message_t &reply)
+{
+    net::MultiGetCommand cmd;
+    if (!cmd.decode(reader))
+        return;
+
+    logging::debug("A request for values of ", cmd.keys.size(), " keys was received.");
+    net::MultiValueResponseData response;
+    response.entries.reserve(cmd.keys.size());
+    // Batches carry their values inline, so large values are joined; a deque keeps the joined strings in place.
+    std::deque<std::string> joined_values;
+    for (auto &key : cmd.keys)
+    {
+        if (auto entry = find_item(key); entry && entry->external())
+        {
+            large_value(*entry).copy_to(joined_values.emplace_back());
+            response.entries.push_back({net::NetworkResponse::KEY_VALUE, joined_values.back()});
+        }
+        else if (entry)
+            response.entries.push_back({net::NetworkResponse::KEY_VALUE, entry->value()});
+        else
+            response.entries.push_back({net::NetworkResponse::KEY_DOES_NOT_EXIST, {}});
+    }
+    reply = net::encode_response(id, response);
+}
+
+void KeyValueShard::handle_multi_delete(net::RequestId id, codec::Reader &reader, zmq::message_t &reply)
+{
+    net::MultiDeleteCommand cmd;
+    if (!cmd.decode(reader))
+        return;
+
+    logging::debug("A request for removing ", cmd.keys.size(), " items was received.");
+    net::MultiStatusResponseData response;
+    response.statuses.reserve(cmd.keys.size());
+    for (auto &key : cmd.keys)
+    {
+        if (remove_item(key))
+        {
+            log_delete(key);
+            response.statuses.push_back(net::NetworkResponse::KEY_DELETED);
+        }
+        else
+            response.statuses.push_back(net::NetworkResponse::KEY_DOES_NOT_EXIST);
+    }
+    reply = net::encode_response(id, response);
+}
+
+void KeyValueShard::handle_scan(net::RequestId id, std::string_view start, std::string_view end, std::string_view cursor,
+                                std::uint32_t limit, std::uint8_t flags, zmq::message_t &reply)
+{
+    logging::debug("A request for scanning the keys from '", start, "' was received.");
+    net::ScanResponseData response;
+    response.limit = page_limit(limit);
+    response.with_values = (flags & net::scan_with_values) != 0;
+    std::deque<std::string> joined_values;
+    response.more = scan_page(start, end, cursor, response.limit, flags,
+        [&](const HashStore::Entry &item)
+        {
+            std::string_view value;
+            if (response.with_values && item.external())
+            {
+                large_value(item).copy_to(joined_values.emplace_back());
+                value = joined_values.back();
+            }
+            else if (response.with_values)
+                value = item.value();
+            response.items.emplace_back(item.key(), value);
+        });
+    reply = net::encode_response(id, response);
+}
+
+bool KeyValueShard::put(std::string_view key, std::string_view value)
+{
+    if (value.size() > net::max_value_size)
+        throw std::length_error("value too large");
+    auto start = TimeStamp::now();
+    auto item = add_item(key, value);
+    if (item)
+    {
+        log_put(*item);
+        evict_if_needed();
+    }
+    command_latency[static_cast<std::size_t>(net::NetworkCommand::PUT_COMMAND)].record(TimeStamp::now() - start);
+    return item != nullptr;
+}
+
+bool KeyValueShard::get(std::string_view key, std::string &value)
+{
+    auto start = TimeStamp::now();
+    auto item = find_item(key);
+    if (item && item->external())
+        large_value(*item).copy_to(value);
+    else if (item)
+        value.assign(item->value());
+    command_latency[static_cast<std::size_t>(net::NetworkCommand::GET_COMMAND)].record(TimeStamp::now() - start);
+    return item != nullptr;
+}
+
+bool KeyValueShard::del(std::string_view key)
+{
+    auto start = TimeStamp::now();
+    auto removed = remove_item(key);
+    if (removed)
+        log_delete(key);
+    command_latency[static_cast<std::size_t>(net::NetworkCommand::DELETE_COMMAND)].record(TimeStamp::now() - start);
+    return removed;
+}
+
+bool KeyValueShard::scan(std::string_view start, std::string_view end, std::string_view cursor, std::uint32_t limit, std::uint8_t flags,
+                         std::vector<std::pair<std::string, std::string>> &items)
+{
+    auto start_time = TimeStamp::now();
+    auto with_values = (flags & net::scan_with_values) != 0;
+    auto more = scan_page(start, end, cursor, page_limit(limit), flags,
+        [&](const HashStore::Entry &item)
+        {
+            auto &[key, value] = items.emplace_back(item.key(), std::string());
+            if (with_values && item.external())
+                large_value(item).copy_to(value);
+            else if (with_values)
+                value.assign(item.value());
+        });
+    command_latency[static_cast<std::size_t>(net::NetworkCommand::SCAN_COMMAND)].record(TimeStamp::now() - start_time);
+    return more;
+}
+
+std::string KeyValueShard::prefix_end(std::string_view prefix)
+{
+    std::string end(prefix);
+    while (!end.empty() && static_cast<std::uint8_t>(end.back()) == 0xFF)
+        end.pop_back();
+    if (!end.empty())
+        end.back() = static_cast<char>(static_cast<std::uint8_t>(end.back()) + 1);
+    return end;
+}
+
+bool KeyValueShard::split_batch(const zmq::message_t &request, std::size_t count, std::vector<zmq::message_t> &requests,
+                                std::vector<std::vector<std::uint32_t>> &positions)
+{
+    requests.clear();
+    requests.resize(count);
+    positions.assign(count, {});
+    codec::Reader reader(request.data(), request.size());
+    net::SendMessage header;
+    if (!header.decode(reader))
+        return false;
+
+    switch (static_cast<net::NetworkCommand>(header.data_type))
+    {
+    case net::NetworkCommand::MULTI_PUT_COMMAND:
+        return split_items<net::MultiPutCommand>(reader, header.id, count, requests, positions);
+    case net::NetworkCommand::MULTI_GET_COMMAND:
+        return split_items<net::MultiGetCommand>(reader, header.id, count, requests, positions);
+    case net::NetworkCommand::MULTI_DELETE_COMMAND:
+        return split_items<net::MultiDeleteCommand>(reader, header.id, count, requests, positions);
+    default:
+        return false;
+    }
+}
+
+zmq::message_t KeyValueShard::merge_batch_replies(const std::vector<zmq::message_t> &parts,
+                                                  const std::vector<std::vector<std::uint32_t>> &positions)
+{
+    // Every shard answers a batch with the same type of reply; the first one tells which.
+    std::size_t first = 0;
+    while (first < parts.size() && positions[first].empty())
+        first++;
+    if (first == parts.size())
+        return zmq::message_t();
+    codec::Reader reader(parts[first].data(), parts[first].size());
+    net::ResponseMessage header;
+    if (!header.decode(reader))
+        return zmq::message_t();
+
+    switch (static_cast<net::NetworkResponse>(header.data_type))
+    {
+    case net::NetworkResponse::MULTI_STATUS:
+    {
+        net::MultiStatusResponseData merged;
+        if (!merge_items(parts, positions, &net::MultiStatusResponseData::statuses, header, merged))
+            return zmq::message_t();
+        return net::encode_response(header.id, merged);
+    }
+    case net::NetworkResponse::MULTI_VALUE:
+    {
+        net::MultiValueResponseData merged;
+        if (!merge_items(parts, positions, &net::MultiValueResponseData::entries, header, merged))
+            return zmq::message_t();
+        return net::encode_response(header.id, merged);
+    }
+    default:
+        return zmq::message_t();
+    }
+}
+
+zmq::message_t KeyValueShard::merge_partial_replies(const std::vector<zmq::message_t> &parts)
+{
+    std::vector<codec::Reader> readers;
+    net::ResponseMessage header;
+    for (auto &part : parts)
+    {
+        readers.emplace_back(part.data(), part.size());
+        if (!header.decode(readers.back()))
+            return zmq::message_t();
+    }
+
+    switch (static_cast<net::NetworkResponse>(header.data_type))
+    {
+    case net::NetworkResponse::SCAN_RESULT:
+    {
+        // Every shard sent the first keys of its own part of the range; a shard that left keys out knows
+        // nothing beyond its last key, so the page ends there, and anything cut off is still there for the next one.
+        net::ScanResponseData merged;
+        bool cut = false;
+        std::string_view bound;
+        for (auto &reader : readers)
+        {
+            net::ScanResponseData partial;
+            if (!partial.decode(reader))
+                return zmq::message_t();
+            merged.limit = partial.limit;
+            merged.with_values = partial.with_values;
+            if (partial.more && !partial.items.empty() && (!cut || partial.items.back().first < bound))
+            {
+                cut = true;
+                bound = partial.items.back().first;
+            }
+            merged.items.insert(merged.items.end(), partial.items.begin(), partial.items.end());
+        }
+        std::sort(merged.items.begin(), merged.items.end());
+        merged.more = cut_scan_page(merged.items, cut, bound, merged.limit);
+        return net::encode_response(header.id, merged);
+    }
+
+    case net::NetworkResponse::STATS:
+    {
+        // Every shard labels its own metrics, so they are simply concatenated.
+        std::string text;
+        for (auto &reader : readers)
+        {
+            net::StatsResponseData partial;
+            if (!partial.decode(reader))
+                return zmq::message_t();
+            text += partial.text;
+        }
+        return net::encode_response(header.id, net::StatsResponseData(text));
+    }
+
+    default:
+        return zmq::message_t();
+    }
+}
+
+const HashStore::Entry *KeyValueShard::find_item(std::string_view key)
+{
+    auto item = key_value_store.find(key);
+    if (!item)
+    {
+        stats_.misses++;
+        return nullptr;
+    }
+    stats_.hits++;
+    if (eviction)
+        eviction->accessed(*item);
+    return item;
+}
+
+const HashStore::Entry *KeyValueShard::add_item(std::string_view key, std::string_view value)
+{
+    // Values that are large enough to be sent in frames are kept in frames, whichever way they arrived.
+    if (value.size() > net::max_inline_value_size)
+    {
+        if (key_value_store.find(key))
+            return nullptr;
+        auto frames = net::make_value_frames(value);
+        return add_item(key, frames);
+    }
+
+    auto [item, inserted] = key_value_store.insert(key, value);
+    if (!inserted)
+        return nullptr;
+    item_added(*item);
+    return item;
+}
+
+const HashStore::Entry *KeyValueShard::add_item(std::string_view key, net::Frames &value_frames)
+{
+    if (key_value_store.find(key))
+        return nullptr;
+    auto value = LargeValue::create(std::move(value_frames));
+    auto item = key_value_store.insert(key, value->handle(), true).first;
+    item_added(*item);
+    return item;
+}
+
+void KeyValueShard::item_added(const HashStore::Entry &item)
+{
+    key_value_size += item_size(item);
+    ordered_index.insert(item);
+    if (eviction)
+        eviction->inserted(item);
+}
+
+void KeyValueShard::remove_item(const HashStore::Entry &item)
+{
+    auto value = item.external() ? LargeValue::from_handle(item.value()) : nullptr;
+    key_value_size -= item_size(item);
+    if (eviction)
+        eviction->erased(item);
+    if (!invalidations.empty())
+        invalidations.invalidate(item.key());
+    ordered_index.erase(item);
+    key_value_store.erase(item);
+    if (value)
+        value->release();
+}
+
+bool KeyValueShard::remove_item(std::string_view key)
+{
+    auto item = key_value_store.find(key);
+    if (!item)
+        return false;
+    remove_item(*item);
+    return true;
+}
+
+void KeyValueShard::log_put(const HashStore::Entry &item)
+{
+    if (!persistence && !replication)
+        return;
+    if (item.external())
+    {
+        auto chunks = large_value(item).chunk_views();
+        if (persistence)
+            persistence->log_put(item.key(), chunks);
+        if (replication)
+            replication->log_put(item.key(), chunks);
+    }
+    else
+    {
+        if (persistence)
+            persistence->log_put(item.key(), item.value());
+        if (replication)
+            replication->log_put(item.key(), item.value());
+    }
+}
+
+void KeyValueShard::log_delete(std::string_view key)
+{
+    if (persistence)
+        persistence->log_delete(key);
+    if (replication)
+        replication->log_delete(key);
+}
+
+// Entries never move, so they can be collected first and removed afterwards.
+void KeyValueShard::clear_items()
+{
+    std::vector<const HashStore::Entry *> items;
+    items.reserve(key_value_store.size());
+    key_value_store.for_each([&items](const HashStore::Entry &item) { items.push_back(&item); });
+    for (auto item : items)
+        remove_item(*item);
+}
+
+std::size_t KeyValueShard::item_size(const HashStore::Entry &item) const
+{
+    auto size = key_value_store.entry_bytes(item);
+    return item.external() ? size + large_value(item).memory_usage() : size;
+}
+
+void KeyValueShard::evict_if_needed()
+{
+    if (!eviction)
+        return;
+    // Only the entries count: the table and the index do not shrink when entries are erased, so counting them
+    // would evict the whole shard once they alone reach the limit.
+    while (key_value_size > max_memory && !key_value_store.empty())
+    {
+        auto victim = eviction->victim();
+        if (!recovering)
+            log_delete(victim->key());
+        remove_item(*victim);
+        stats_.evictions++;
+    }
+}
+
+void KeyValueShard::print_stats() const
+{
+    logging::info("Shard ", index, ": ", key_value_store.size(), " items, ", memory_usage(), " bytes, ",
+                  stats_.hits, " hits, ", stats_.misses, " misses, ", stats_.evictions, " evictions.");
+}
+
+std::string KeyValueShard::stats_text() const
+{
+    std::ostringstream text;
+    auto shard = "shard=\"" + std::to_string(index) + "\"";
+    text << "kv_items{" << shard << "} " << key_value_store.size() << '\n'
+         << "kv_memory_bytes{" << shard << "} " << memory_usage() << '\n'
+         << "kv_hits_total{" << shard << "} " << stats_.hits << '\n'
+         << "kv_misses_total{" << shard << "} " << stats_.misses << '\n'
+         << "kv_evictions_total{" << shard << "} " << stats_.evictions << '\n'
+         << "kv_bad_requests_total{" << shard << "} " << stats_.bad_requests << '\n';
+    if (replication)
+        text << "kv_replication_published_sequence{" << shard << "} " << replication->sequence() << '\n';
+    text << "kv_tracked_keys{" << shard << "} " << invalidations.tracked_keys() << '\n'
+         << "kv_tracking_clients{" << shard << "} " << invalidations.tracking_clients() << '\n'
+         << "kv_invalidations_total{" << shard << "} " << invalidations.invalidations() << '\n';
+
+    for (std::size_t i = 0; i < net::command_count; i++)
+    {
+        auto &latency = command_latency[i];
+        auto labels = shard + ",command=\"" + net::command_name(static_cast<net::NetworkCommand>(i)) + "\"";
+        text << "kv_requests_total{" << labels << "} " << latency.count() << '\n';
+        if (latency.count() == 0)
+            continue;
+        text << "kv_request_latency_ns{" << labels << ",quantile=\"0.5\"} " << latency.value_at_percentile(50) << '\n'
+             << "kv_request_latency_ns{" << labels << ",quantile=\"0.99\"} " << latency.value_at_percentile(99) << '\n'
+             << "kv_request_latency_ns{" << labels << ",quantile=\"0.999\"} " << latency.value_at_percentile(99.9) << '\n'
+             << "kv_request_latency_ns_max{" << labels << "} " << latency.max() << '\n';
+    }
+    return text.str();
+}
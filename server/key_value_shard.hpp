@@ -0,0 +1,213 @@
+#ifndef KEY_VALUE_SHARD_HPP_
+#define KEY_VALUE_SHARD_HPP_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "cpp_helpers/latency_histogram.hpp"
+#include "cpp_helpers/network_message.hpp"
+#include "eviction_policy.hpp"
+#include "hash_store.hpp"
+#include "invalidation_tracker.hpp"
+#include "large_value.hpp"
+#include "ordered_index.hpp"
+#include "persistence.hpp"
+#include "replication.hpp"
+
+// One partition of the keyspace. A shard is only ever touched by a single thread, so it needs no locking.
+class KeyValueShard
+{
+public:
+    struct Stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t bad_requests = 0;
+    };
+
+private:
+    // How many entries are written to a running snapshot per tick.
+    static constexpr std::size_t snapshot_entries_per_tick = 4096;
+
+    std::size_t index;
+    std::size_t count;
+    // Exact heap bytes of all entries and large values, which the memory limit bounds; the hash table comes on top.
+    std::size_t key_value_size;
+    std::size_t max_memory;
+    HashStore key_value_store;
+    // The same entries in key order, for SCAN and PREFIX_SCAN.
+    OrderedIndex ordered_index;
+    // The clients that read entries with TRACKED_GET.
+    InvalidationTracker invalidations;
+    std::unique_ptr<EvictionPolicy> eviction;
+    Stats stats_;
+    // Service time of every command, indexed by net::NetworkCommand.
+    std::vector<stats::LatencyHistogram> command_latency;
+    std::unique_ptr<Persistence> persistence;
+    // Set on a primary that publishes its mutations.
+    std::unique_ptr<ReplicationLog> replication;
+    bool recovering;
+    bool snapshotting;
+    // The last key written to the running snapshot.
+    std::string snapshot_cursor;
+    bool snapshot_after_cursor;
+
+public:
+    KeyValueShard(std::size_t index = 0, std::size_t count = 1, const PersistenceOptions &persistence_options = {},
+                  const EvictionOptions &eviction_options = {}, const ReplicationOptions &replication_options = {});
+    ~KeyValueShard();
+
+    KeyValueShard(const KeyValueShard &) = delete;
+    KeyValueShard &operator=(const KeyValueShard &) = delete;
+
+    // Loads the persisted data, if persistence is enabled. Must be called before the first request.
+    void recover();
+    // Makes the mutations of the requests handled so far durable; replies must only be sent afterwards.
+    void commit();
+    // Background work (periodic fsync, snapshot progress); call it after every batch and when idle.
+    void tick();
+    // How long the owner may wait for requests before calling tick() again: not at all while a snapshot can
+    // make progress, so that its speed does not depend on the request traffic; 'idle_ms' otherwise.
+    long poll_timeout_ms(long idle_ms);
+
+    // The mutations since the last call, to publish to the replicas; an empty message when there is nothing
+    // to send yet. Call it after commit() and tick().
+    zmq::message_t take_replication_batch();
+    // Applies a batch of a replication stream (net::ReplicationBatch) to the keys this shard owns.
+    // Returns false when the batch could not be decoded.
+    bool apply_replication_batch(const zmq::message_t &batch);
+
+    const Stats &stats() const { return stats_; }
+    std::size_t memory_usage() const { return key_value_size + key_value_store.table_bytes() + ordered_index.memory_usage(); }
+    void print_stats() const;
+    // The counters and latency percentiles of this shard as returned by STATS.
+    std::string stats_text() const;
+
+    static std::size_t shard_of(std::string_view key, std::size_t count)
+    {
+        return count > 1 ? std::hash<std::string_view>{}(key) % count : 0;
+    }
+
+    // Handles one encoded request of the client 'identity' and encodes its response into 'reply'. 'value_frames' are the frames that
+    // followed the request, the value of a large PUT, which the shard takes over; 'reply_frames' receives the
+    // frames to send after the reply, the value of a large GET.
+    // Returns false when the request could not be decoded and there is nothing to reply.
+    // A batch must only hold keys of this shard; split_batch() divides the client's batches accordingly.
+    bool handle_request(const zmq::message_t &identity, const zmq::message_t &request, net::Frames &value_frames, zmq::message_t &reply,
+                        net::Frames &reply_frames);
+    // The INVALIDATE pushes for the clients whose tracked keys changed; send them after the replies of the
+    // same batch, so a client never gets told about a value before it gets the value.
+    void take_invalidations(std::vector<InvalidationTracker::Push> &pushes) { invalidations.take(pushes); }
+    // Splits the batch 'request' among 'count' shards: 'requests[i]' becomes the batch of the keys of shard i,
+    // with the same request id, and 'positions[i]' their positions in 'request'; shards without keys get an
+    // empty message. Returns false when the batch cannot be decoded or has to be refused as a whole.
+    static bool split_batch(const zmq::message_t &request, std::size_t count, std::vector<zmq::message_t> &requests,
+                            std::vector<std::vector<std::uint32_t>> &positions);
+    // Puts the replies to the parts of a split batch back into the order of its keys; 'parts[i]' is the reply
+    // of shard i, unused when 'positions[i]' is empty. Returns an empty message when a reply does not fit.
+    static zmq::message_t merge_batch_replies(const std::vector<zmq::message_t> &parts,
+                                              const std::vector<std::vector<std::uint32_t>> &positions);
+    // Combines the replies of every shard to a SCAN, PREFIX_SCAN or STATS.
+    static zmq::message_t merge_partial_replies(const std::vector<zmq::message_t> &parts);
+
+    // The in-process API: PUT, GET, DELETE and SCAN without encoding anything, logged, evicted and counted
+    // in the statistics like the commands. Values are copied out.
+    bool put(std::string_view key, std::string_view value);
+    bool get(std::string_view key, std::string &value);
+    bool del(std::string_view key);
+    // Appends one page of the keys in [start, end) to 'items', with their values if 'flags' has
+    // net::scan_with_values; returns whether keys are left after it. Arguments as in net::ScanCommand.
+    bool scan(std::string_view start, std::string_view end, std::string_view cursor, std::uint32_t limit, std::uint8_t flags,
+              std::vector<std::pair<std::string, std::string>> &items);
+    // The smallest key above every key that starts with 'prefix', or an empty string if there is none.
+    static std::string prefix_end(std::string_view prefix);
+    // Cuts the sorted items of the pages several shards returned for one scan down to the page of them all:
+    // before any key above 'bound', the smallest last key of the pages with keys left ('cut' tells whether
+    // there is one), and within 'limit' keys and net::max_scan_page_bytes. Returns whether keys are left.
+    template <typename Item>
+    static bool cut_scan_page(std::vector<Item> &items, bool cut, std::string_view bound, std::uint32_t limit);
+
+private:
+    bool owns(std::string_view key) const { return shard_of(key, count) == index; }
+    bool dispatch_request(std::string_view client, const zmq::message_t &request, net::Frames &value_frames, zmq::message_t &reply,
+                          net::Frames &reply_frames, net::NetworkCommand &command);
+    void handle_multi_put(net::RequestId id, codec::Reader &reader, zmq::message_t &reply);
+    void handle_multi_get(net::RequestId id, codec::Reader &reader, zmq::message_t &reply);
+    void handle_multi_delete(net::RequestId id, codec::Reader &reader, zmq::message_t &reply);
+    // One page of the keys in [start, end); an empty 'end' means no upper bound.
+    void handle_scan(net::RequestId id, std::string_view start, std::string_view end, std::string_view cursor, std::uint32_t limit,
+                     std::uint8_t flags, zmq::message_t &reply);
+    // Calls 'function' with the entries of one page of at most 'limit' keys, in order; returns whether keys are left.
+    template <typename Function>
+    bool scan_page(std::string_view start, std::string_view end, std::string_view cursor, std::uint32_t limit, std::uint8_t flags,
+                   Function function) const;
+    const HashStore::Entry *find_item(std::string_view key);
+    // Both return the new item, or nullptr when the key exists already.
+    const HashStore::Entry *add_item(std::string_view key, std::string_view value);
+    // Takes over the frames of a large value.
+    const HashStore::Entry *add_item(std::string_view key, net::Frames &value_frames);
+    void item_added(const HashStore::Entry &item);
+    void remove_item(const HashStore::Entry &item);
+    bool remove_item(std::string_view key);
+    void log_put(const HashStore::Entry &item);
+    void log_delete(std::string_view key);
+    void clear_items();
+    void evict_if_needed();
+    void continue_snapshot();
+    // Heap bytes of the entry, and of its frames for a large value.
+    std::size_t item_size(const HashStore::Entry &item) const;
+};
+
+template <typename Function>
+bool KeyValueShard::scan_page(std::string_view start, std::string_view end, std::string_view cursor, std::uint32_t limit, std::uint8_t flags,
+                              Function function) const
+{
+    // Only this shard's keys are in its index; the other shards answer for theirs.
+    std::uint32_t taken = 0;
+    std::size_t bytes = 0;
+    bool more = false;
+    auto with_values = (flags & net::scan_with_values) != 0;
+    auto after_cursor = (flags & net::scan_after_cursor) != 0 && cursor >= start;
+    ordered_index.scan(after_cursor ? cursor : start, after_cursor,
+        [&](const HashStore::Entry &item)
+        {
+            if (!end.empty() && item.key() >= end)
+                return false;
+            auto size = item.key().size();
+            if (with_values)
+                size += item.external() ? LargeValue::from_handle(item.value())->size() : item.value().size();
+            if (taken == limit || (taken > 0 && bytes + size > net::max_scan_page_bytes))
+            {
+                more = true;
+                return false;
+            }
+            taken++;
+            bytes += size;
+            function(item);
+            return true;
+        });
+    return more;
+}
+
+template <typename Item>
+bool KeyValueShard::cut_scan_page(std::vector<Item> &items, bool cut, std::string_view bound, std::uint32_t limit)
+{
+    // Values are empty unless the scan asked for them.
+    std::size_t taken = 0;
+    std::size_t bytes = 0;
+    for (; taken < items.size() && taken < limit && (!cut || items[taken].first <= bound); taken++)
+    {
+        auto size = items[taken].first.size() + items[taken].second.size();
+        if (taken > 0 && bytes + size > net::max_scan_page_bytes)
+            break;
+        bytes += size;
+    }
+    auto more = cut || taken < items.size();
+    items.resize(taken);
+    return more;
+}
+
+#endif // !KEY_VALUE_SHARD_HPP_
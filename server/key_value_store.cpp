@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <stdexcept>
+#include "key_value_store.hpp"
+
+KeyValueStore::KeyValueStore(std::size_t shard_count, const PersistenceOptions &persistence_options, const EvictionOptions &eviction_options)
+{
+    if (shard_count == 0)
+        throw std::invalid_argument("a store needs at least one shard");
+    auto shard_eviction = eviction_options;
+    if (shard_eviction.enabled())
+        shard_eviction.max_memory = std::max<std::size_t>(shard_eviction.max_memory / shard_count, 1);
+    for (std::size_t i = 0; i < shard_count; i++)
+    {
+        shards.push_back(std::make_unique<Shard>(i, shard_count, persistence_options, shard_eviction));
+        shards.back()->shard.recover();
+    }
+}
+
+bool KeyValueStore::put(std::string_view key, std::string_view value)
+{
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto added = shard.shard.put(key, value);
+    shard.shard.commit();
+    shard.shard.tick();
+    return added;
+}
+
+bool KeyValueStore::get(std::string_view key, std::string &value)
+{
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.shard.get(key, value);
+}
+
+bool KeyValueStore::del(std::string_view key)
+{
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto removed = shard.shard.del(key);
+    shard.shard.commit();
+    shard.shard.tick();
+    return removed;
+}
+
+// Every shard contributes the first page of its own part of the range; the page is cut from all of them as
+// the server does for SCAN.
+KeyValueStore::ScanPage KeyValueStore::scan(std::string_view start, std::string_view end, std::uint32_t limit, std::uint8_t flags,
+                                            std::string_view cursor)
+{
+    ScanPage page;
+    bool cut = false;
+    std::string bound;
+    for (auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        auto first = page.items.size();
+        if (shard->shard.scan(start, end, cursor, limit, flags, page.items) && page.items.size() > first &&
+            (!cut || page.items.back().first < bound))
+        {
+            cut = true;
+            bound = page.items.back().first;
+        }
+    }
+    if (shards.size() == 1)
+    {
+        page.more = cut;
+        return page;
+    }
+
+    std::sort(page.items.begin(), page.items.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    auto page_size = limit == 0 || limit > net::max_scan_limit ? net::max_scan_limit : limit;
+    page.more = KeyValueShard::cut_scan_page(page.items, cut, bound, page_size);
+    return page;
+}
+
+KeyValueStore::ScanPage KeyValueStore::prefix_scan(std::string_view prefix, std::uint32_t limit, std::uint8_t flags, std::string_view cursor)
+{
+    return scan(prefix, KeyValueShard::prefix_end(prefix), limit, flags, cursor);
+}
+
+std::string KeyValueStore::stats()
+{
+    std::string text;
+    for (auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        text += shard->shard.stats_text();
+    }
+    return text;
+}
+
+void KeyValueStore::tick()
+{
+    for (auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->shard.commit();
+        shard->shard.tick();
+    }
+}
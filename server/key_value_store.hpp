@@ -0,0 +1,72 @@
+#ifndef KEY_VALUE_STORE_HPP_
+#define KEY_VALUE_STORE_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "eviction_policy.hpp"
+#include "key_value_shard.hpp"
+#include "persistence.hpp"
+
+// The store for use inside another process: the shards of a server behind plain C++ calls, with no
+// encoding and no sockets. Keys are split over the shards by hash as in the server, so a data directory
+// written by a server with N threads is opened with N shards. Calls may come from any thread; every
+// shard has its own lock, so calls on keys of different shards run in parallel.
+//
+// Every write is committed before the call returns, which syncs the log as the fsync policy says. An
+// interval policy only gets to sync on a later call, or on tick(), which an otherwise idle owner should
+// call now and then; snapshots also progress on both.
+class KeyValueStore
+{
+public:
+    struct ScanPage
+    {
+        // Keys in order, with their values if they were asked for.
+        std::vector<std::pair<std::string, std::string>> items;
+        bool more = false;
+    };
+
+private:
+    struct Shard
+    {
+        std::mutex mutex;
+        KeyValueShard shard;
+
+        Shard(std::size_t index, std::size_t count, const PersistenceOptions &persistence_options, const EvictionOptions &eviction_options)
+            : shard(index, count, persistence_options, eviction_options)
+        {
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+public:
+    // 'eviction_options.max_memory' bounds the whole store and is split evenly over the shards.
+    KeyValueStore(std::size_t shard_count = 1, const PersistenceOptions &persistence_options = {}, const EvictionOptions &eviction_options = {});
+
+    KeyValueStore(const KeyValueStore &) = delete;
+    KeyValueStore &operator=(const KeyValueStore &) = delete;
+
+    // Returns false when the key exists already.
+    bool put(std::string_view key, std::string_view value);
+    // Returns false when the key does not exist.
+    bool get(std::string_view key, std::string &value);
+    bool del(std::string_view key);
+    // One page of the keys in [start, end) as SCAN returns it: 'flags' are net::scan_with_values and
+    // net::scan_after_cursor, and the next page starts after the last key of this one.
+    ScanPage scan(std::string_view start, std::string_view end, std::uint32_t limit = net::max_scan_limit, std::uint8_t flags = 0,
+                  std::string_view cursor = {});
+    ScanPage prefix_scan(std::string_view prefix, std::uint32_t limit = net::max_scan_limit, std::uint8_t flags = 0, std::string_view cursor = {});
+    // The same text as STATS.
+    std::string stats();
+    void tick();
+
+private:
+    Shard &shard_of(std::string_view key) { return *shards[KeyValueShard::shard_of(key, shards.size())]; }
+};
+
+#endif // !KEY_VALUE_STORE_HPP_
@@ -0,0 +1,66 @@
+#include <cstring>
+#include "large_value.hpp"
+
+LargeValue::LargeValue(net::Frames &&chunks)
+    : chunks(std::move(chunks)),
+      size_(0),
+      references(1),
+      self(this)
+{
+    for (auto &chunk : this->chunks)
+        size_ += chunk.size();
+}
+
+LargeValue *LargeValue::create(net::Frames &&chunks)
+{
+    return new LargeValue(std::move(chunks));
+}
+
+LargeValue *LargeValue::from_handle(std::string_view handle)
+{
+    LargeValue *value;
+    std::memcpy(&value, handle.data(), sizeof(value));
+    return value;
+}
+
+void LargeValue::release()
+{
+    if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+void LargeValue::release_frame(void *, void *hint)
+{
+    static_cast<LargeValue *>(hint)->release();
+}
+
+std::size_t LargeValue::memory_usage() const
+{
+    return sizeof(LargeValue) + chunks.capacity() * sizeof(zmq::message_t) + size_;
+}
+
+std::vector<std::string_view> LargeValue::chunk_views() const
+{
+    std::vector<std::string_view> views;
+    views.reserve(chunks.size());
+    for (auto &chunk : chunks)
+        views.emplace_back(static_cast<const char *>(chunk.data()), chunk.size());
+    return views;
+}
+
+void LargeValue::append_frames(net::Frames &frames)
+{
+    for (auto &chunk : chunks)
+    {
+        references.fetch_add(1, std::memory_order_relaxed);
+        frames.emplace_back(const_cast<void *>(chunk.data()), chunk.size(), &LargeValue::release_frame, this);
+    }
+}
+
+void LargeValue::copy_to(std::string &value) const
+{
+    value.clear();
+    value.reserve(size_);
+    for (auto &chunk : chunks)
+        value.append(static_cast<const char *>(chunk.data()), chunk.size());
+}
@@ -0,0 +1,50 @@
+#ifndef LARGE_VALUE_HPP_
+#define LARGE_VALUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include "cpp_helpers/networking.hpp"
+
+// A value kept as the frames it arrived in, outside the hash store; the store only holds a handle to it.
+//
+// Storing the value copies nothing: the frames of the PUT are taken as they are. A GET copies nothing
+// either: its reply frames point at the same buffers and each holds a reference, which ZeroMQ drops through
+// the frame's free callback once the frame is sent. References are atomic because that callback runs on
+// a ZeroMQ I/O thread. The value is freed with its last reference, the store's or that of a reply.
+class LargeValue
+{
+private:
+    net::Frames chunks;
+    std::size_t size_;
+    std::atomic<std::size_t> references;
+    // The handle stored in the hash store is the bytes of this pointer.
+    LargeValue *self;
+
+    explicit LargeValue(net::Frames &&chunks);
+    ~LargeValue() = default;
+
+    static void release_frame(void *data, void *hint);
+
+public:
+    LargeValue(const LargeValue &) = delete;
+    LargeValue &operator=(const LargeValue &) = delete;
+
+    // Takes the frames; the new value has one reference, which belongs to the caller.
+    static LargeValue *create(net::Frames &&chunks);
+    static LargeValue *from_handle(std::string_view handle);
+    void release();
+
+    std::string_view handle() const { return std::string_view(reinterpret_cast<const char *>(&self), sizeof(self)); }
+    std::size_t size() const { return size_; }
+    // Heap bytes held by the value.
+    std::size_t memory_usage() const;
+    std::vector<std::string_view> chunk_views() const;
+    // Appends frames that share the buffers of the value, for a reply.
+    void append_frames(net::Frames &frames);
+    // Joins the chunks into 'value'.
+    void copy_to(std::string &value) const;
+};
+
+#endif // !LARGE_VALUE_HPP_
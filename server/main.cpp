@@ -19,25 +19,29 @@ int main(int argc, char *argv[])
 
     try
     {
-        if (argc != 2)
+        ServerOptions options;
+        try
         {
-            std::cerr << "Usage: server <port>\n";
+            options = ServerOptions::parse(argc, argv);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Invalid arguments: " << e.what() << "\n" << ServerOptions::usage();
             return 1;
         }
 
-        KeyValueServer key_value_server(std::stoi(argv[1]));
+        logging::logger().set_level(options.log_level);
+        KeyValueServer key_value_server(options);
 
-        std::cout << "Server started ..." << std::endl;
-        while (gSignalStatus == 0)
-        {
-            key_value_server.handle_requests();
-            std::this_thread::sleep_for(std::chrono::milliseconds(33));
-        }
+        logging::info("Server started with ", options.threads, " thread(s) ...");
+        key_value_server.run(gSignalStatus);
+        logging::info("Server stopped.");
     }
     catch (std::exception &e)
     {
-        std::cerr << "Exception: " << e.what() << "\n";
+        logging::error("Exception: ", e.what());
     }
 
+    logging::logger().flush();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "ordered_index.hpp"
+
+OrderedIndex::OrderedIndex()
+    : root(nullptr),
+      size_(0),
+      leaf_count(0),
+      inner_count(0),
+      separator_bytes(0)
+{
+    clear();
+}
+
+OrderedIndex::~OrderedIndex()
+{
+    free_node(root);
+}
+
+std::size_t OrderedIndex::memory_usage() const
+{
+    return leaf_count * sizeof(Leaf) + inner_count * sizeof(Inner) + separator_bytes;
+}
+
+void OrderedIndex::clear()
+{
+    free_node(root);
+    auto leaf = new Leaf();
+    leaf->leaf = true;
+    leaf->count = 0;
+    leaf->offset = 0;
+    leaf->previous = nullptr;
+    leaf->next = nullptr;
+    root = leaf;
+    size_ = 0;
+    leaf_count = 1;
+    inner_count = 0;
+    separator_bytes = 0;
+}
+
+std::uint64_t OrderedIndex::prefix_of(std::string_view key, std::size_t offset)
+{
+    std::uint64_t prefix = 0;
+    for (auto i = offset; i < offset + sizeof(prefix); i++)
+        prefix = (prefix << 8) | (i < key.size() ? static_cast<std::uint8_t>(key[i]) : 0);
+    return prefix;
+}
+
+std::size_t OrderedIndex::common_prefix(std::string_view a, std::string_view b)
+{
+    auto size = std::min(a.size(), b.size());
+    std::size_t i = 0;
+    while (i < size && a[i] == b[i])
+        i++;
+    return i;
+}
+
+// Orders 'key' against the 'offset' bytes that 'sample', and every other key of its node, starts with:
+// negative if it orders before all of them, positive if after, 0 if it starts with those bytes too.
+int OrderedIndex::compare_head(std::string_view sample, std::size_t offset, std::string_view key)
+{
+    return key.substr(0, offset).compare(sample.substr(0, offset));
+}
+
+std::size_t OrderedIndex::separator_size(const Separator &separator)
+{
+    // Short keys live inside the std::string.
+    return separator.key.capacity() > sizeof(std::string) / 2 ? separator.key.capacity() : 0;
+}
+
+// Past the common head, keys that differ in their next 8 bytes order like those bytes (a missing byte
+// counts as 0 and orders before any other); only keys with equal prefixes are compared in full.
+std::size_t OrderedIndex::lower_bound(const Leaf &leaf, std::string_view key)
+{
+    if (leaf.count == 0)
+        return 0;
+    if (auto order = compare_head(leaf.items[0].entry->key(), leaf.offset, key); order != 0)
+        return order < 0 ? 0 : leaf.count;
+
+    auto prefix = prefix_of(key, leaf.offset);
+    auto tail = key.substr(leaf.offset);
+    std::size_t low = 0, high = leaf.count;
+    while (low < high)
+    {
+        auto middle = (low + high) / 2;
+        auto &item = leaf.items[middle];
+        if (item.prefix != prefix ? item.prefix < prefix : item.entry->key().substr(leaf.offset) < tail)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// The first child whose separator is above the key.
+std::size_t OrderedIndex::child_of(const Inner &inner, std::string_view key)
+{
+    std::size_t separators = inner.count - 1u;
+    if (separators == 0)
+        return 0;
+    if (auto order = compare_head(inner.separators[0].key, inner.offset, key); order != 0)
+        return order < 0 ? 0 : separators;
+
+    auto prefix = prefix_of(key, inner.offset);
+    auto tail = key.substr(inner.offset);
+    std::size_t low = 0, high = separators;
+    while (low < high)
+    {
+        auto middle = (low + high) / 2;
+        auto &separator = inner.separators[middle];
+        if (prefix != separator.prefix ? prefix < separator.prefix : tail < std::string_view(separator.key).substr(inner.offset))
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return low;
+}
+
+void OrderedIndex::set_offset(Leaf &leaf, std::size_t offset)
+{
+    leaf.offset = static_cast<std::uint16_t>(offset);
+    for (std::size_t i = 0; i < leaf.count; i++)
+        leaf.items[i].prefix = prefix_of(leaf.items[i].entry->key(), offset);
+}
+
+// Recomputes the common head and the prefixes of the separators after they changed. Inner nodes only
+// change when a node below them splits or empties, so this is rare next to the searches it speeds up.
+void OrderedIndex::refresh(Inner &inner)
+{
+    std::size_t separators = inner.count - 1u;
+    inner.offset = separators > 0 ? static_cast<std::uint16_t>(common_prefix(inner.separators[0].key, inner.separators[separators - 1].key)) : 0;
+    for (std::size_t i = 0; i < separators; i++)
+        inner.separators[i].prefix = prefix_of(inner.separators[i].key, inner.offset);
+}
+
+OrderedIndex::Leaf *OrderedIndex::find_leaf(std::string_view key, Path *path) const
+{
+    auto node = root;
+    while (!node->leaf)
+    {
+        auto inner = static_cast<Inner *>(node);
+        auto child = child_of(*inner, key);
+        if (path)
+        {
+            if (path->depth == max_depth)
+                throw std::length_error("ordered index too deep");
+            path->nodes[path->depth] = inner;
+            path->children[path->depth] = child;
+            path->depth++;
+        }
+        node = inner->children[child];
+    }
+    return static_cast<Leaf *>(node);
+}
+
+void OrderedIndex::insert(const Entry &entry)
+{
+    auto key = entry.key();
+    Path path;
+    auto leaf = find_leaf(key, &path);
+    auto index = lower_bound(*leaf, key);
+    size_++;
+
+    if (leaf->count < leaf_capacity)
+    {
+        // The common head of the keys can only get shorter.
+        if (leaf->count == 0)
+            leaf->offset = static_cast<std::uint16_t>(key.size());
+        else if (auto common = common_prefix(key, leaf->items[0].entry->key()); common < leaf->offset)
+            set_offset(*leaf, common);
+        std::copy_backward(leaf->items + index, leaf->items + leaf->count, leaf->items + leaf->count + 1);
+        leaf->items[index] = {prefix_of(key, leaf->offset), &entry};
+        leaf->count++;
+        return;
+    }
+
+    // Split the full leaf, with the new item, in halves.
+    Item items[leaf_capacity + 1];
+    std::copy(leaf->items, leaf->items + index, items);
+    items[index] = {0, &entry};
+    std::copy(leaf->items + index, leaf->items + leaf_capacity, items + index + 1);
+
+    auto right = new Leaf();
+    leaf_count++;
+    right->leaf = true;
+    auto half = (leaf_capacity + 1) / 2;
+    leaf->count = static_cast<std::uint16_t>(half);
+    right->count = static_cast<std::uint16_t>(leaf_capacity + 1 - half);
+    std::copy(items, items + half, leaf->items);
+    std::copy(items + half, items + leaf_capacity + 1, right->items);
+    right->previous = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->previous = right;
+    leaf->next = right;
+
+    for (auto half_leaf : {leaf, right})
+        set_offset(*half_leaf, common_prefix(half_leaf->items[0].entry->key(), half_leaf->items[half_leaf->count - 1].entry->key()));
+
+    insert_child(path, {0, std::string(right->items[0].entry->key())}, right);
+}
+
+// Adds 'child' right after the child taken at the end of 'path', with 'separator' between the two.
+void OrderedIndex::insert_child(Path &path, Separator separator, Node *child)
+{
+    separator_bytes += separator_size(separator);
+    if (path.depth == 0)
+    {
+        auto new_root = new Inner();
+        inner_count++;
+        new_root->leaf = false;
+        new_root->count = 2;
+        new_root->children[0] = root;
+        new_root->children[1] = child;
+        new_root->separators[0] = std::move(separator);
+        refresh(*new_root);
+        root = new_root;
+        return;
+    }
+
+    path.depth--;
+    auto inner = path.nodes[path.depth];
+    auto index = path.children[path.depth] + 1;
+    if (inner->count < inner_capacity)
+    {
+        std::move_backward(inner->separators + index - 1, inner->separators + inner->count - 1, inner->separators + inner->count);
+        std::copy_backward(inner->children + index, inner->children + inner->count, inner->children + inner->count + 1);
+        inner->separators[index - 1] = std::move(separator);
+        inner->children[index] = child;
+        inner->count++;
+        refresh(*inner);
+        return;
+    }
+
+    // Split the full node: lay out all children and separators, give the lower half to 'inner', the
+    // upper half to a new node, and move the separator in the middle up.
+    Separator separators[inner_capacity];
+    Node *children[inner_capacity + 1];
+    std::move(inner->separators, inner->separators + index - 1, separators);
+    separators[index - 1] = std::move(separator);
+    std::move(inner->separators + index - 1, inner->separators + inner_capacity - 1, separators + index);
+    std::copy(inner->children, inner->children + index, children);
+    children[index] = child;
+    std::copy(inner->children + index, inner->children + inner_capacity, children + index + 1);
+
+    auto left_count = (inner_capacity + 1) / 2;
+    auto right = new Inner();
+    inner_count++;
+    right->leaf = false;
+    right->count = static_cast<std::uint16_t>(inner_capacity + 1 - left_count);
+    inner->count = static_cast<std::uint16_t>(left_count);
+    std::move(separators, separators + left_count - 1, inner->separators);
+    std::copy(children, children + left_count, inner->children);
+    std::move(separators + left_count, separators + inner_capacity, right->separators);
+    std::copy(children + left_count, children + inner_capacity + 1, right->children);
+    for (auto i = left_count - 1; i < inner_capacity - 1; i++)
+        inner->separators[i].key = std::string();
+    refresh(*inner);
+    refresh(*right);
+
+    // The separator moved up is counted again by the caller.
+    auto up = std::move(separators[left_count - 1]);
+    separator_bytes -= separator_size(up);
+    insert_child(path, std::move(up), right);
+}
+
+void OrderedIndex::erase(const Entry &entry)
+{
+    auto key = entry.key();
+    Path path;
+    auto leaf = find_leaf(key, &path);
+    auto index = lower_bound(*leaf, key);
+    if (index == leaf->count || leaf->items[index].entry != &entry)
+        return;
+
+    std::copy(leaf->items + index + 1, leaf->items + leaf->count, leaf->items + index);
+    leaf->count--;
+    size_--;
+    if (leaf->count > 0 || path.depth == 0)
+        return;
+
+    if (leaf->previous)
+        leaf->previous->next = leaf->next;
+    if (leaf->next)
+        leaf->next->previous = leaf->previous;
+    delete leaf;
+    leaf_count--;
+    erase_child(path);
+}
+
+// Removes the child taken at the end of 'path', which was freed already.
+void OrderedIndex::erase_child(Path &path)
+{
+    path.depth--;
+    auto inner = path.nodes[path.depth];
+    auto index = path.children[path.depth];
+
+    if (inner->count == 1)
+    {
+        // The last child is gone, and so is the node. The root always has two children at least.
+        delete inner;
+        inner_count--;
+        erase_child(path);
+        return;
+    }
+
+    // The separator on either side of the child can go; the one left still splits the remaining neighbours.
+    auto separator = index > 0 ? index - 1 : 0;
+    separator_bytes -= separator_size(inner->separators[separator]);
+    std::move(inner->separators + separator + 1, inner->separators + inner->count - 1, inner->separators + separator);
+    inner->separators[inner->count - 2].key = std::string();
+    std::copy(inner->children + index + 1, inner->children + inner->count, inner->children + index);
+    inner->count--;
+    refresh(*inner);
+
+    // A root with a single child gives way to that child, which may have a single child itself.
+    while (!root->leaf && root->count == 1)
+    {
+        auto old_root = static_cast<Inner *>(root);
+        root = old_root->children[0];
+        delete old_root;
+        inner_count--;
+    }
+}
+
+void OrderedIndex::free_node(Node *node)
+{
+    if (!node)
+        return;
+    if (node->leaf)
+    {
+        delete static_cast<Leaf *>(node);
+    }
+    else
+    {
+        auto inner = static_cast<Inner *>(node);
+        for (std::size_t i = 0; i < inner->count; i++)
+            free_node(inner->children[i]);
+        delete inner;
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef ORDERED_INDEX_HPP_
+#define ORDERED_INDEX_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "hash_store.hpp"
+
+// The keys of a HashStore in order, for range and prefix scans.
+//
+// A B+-tree whose leaves hold pointers to the store's entries, which never move, so no key is copied.
+// Every node knows how many leading bytes all its keys share, and keeps the next 8 bytes of every key,
+// big-endian, next to it. Keys with long common prefixes (tenant:<id>:...) therefore still differ in
+// those 8 bytes, and most comparisons are a single integer compare that never touches the entry.
+// Leaves are linked both ways; a scan walks them in order without climbing back up the tree.
+//
+// Separators in the inner nodes are copies of keys. A separator only has to lie between its neighbours,
+// so it may outlive the key it was copied from. Nodes are not merged when they shrink; a node is freed
+// once it is empty.
+class OrderedIndex
+{
+private:
+    using Entry = HashStore::Entry;
+
+    static constexpr std::size_t leaf_capacity = 32;
+    static constexpr std::size_t inner_capacity = 32;
+    static constexpr std::size_t max_depth = 16;
+
+    struct Item
+    {
+        std::uint64_t prefix;
+        const Entry *entry;
+    };
+
+    struct Separator
+    {
+        std::uint64_t prefix;
+        std::string key;
+    };
+
+    struct Node
+    {
+        bool leaf;
+        // Items of a leaf, children of an inner node.
+        std::uint16_t count;
+        // The keys of a leaf, or the separators of an inner node, all start with the same 'offset' bytes;
+        // their prefixes are the 8 bytes after those.
+        std::uint16_t offset;
+    };
+
+    struct Leaf : Node
+    {
+        Leaf *previous;
+        Leaf *next;
+        Item items[leaf_capacity];
+    };
+
+    struct Inner : Node
+    {
+        // separators[i] lies between the keys of children[i] and those of children[i + 1].
+        Separator separators[inner_capacity - 1];
+        Node *children[inner_capacity];
+    };
+
+    // The inner nodes on the way from the root to a leaf, and the child taken in each of them.
+    struct Path
+    {
+        Inner *nodes[max_depth];
+        std::size_t children[max_depth];
+        std::size_t depth = 0;
+    };
+
+    Node *root;
+    std::size_t size_;
+    std::size_t leaf_count;
+    std::size_t inner_count;
+    std::size_t separator_bytes;
+
+public:
+    OrderedIndex();
+    ~OrderedIndex();
+
+    OrderedIndex(const OrderedIndex &) = delete;
+    OrderedIndex &operator=(const OrderedIndex &) = delete;
+
+    std::size_t size() const { return size_; }
+    // Heap bytes of the nodes.
+    std::size_t memory_usage() const;
+
+    // The key of 'entry' must not be in the index yet.
+    void insert(const Entry &entry);
+    void erase(const Entry &entry);
+    void clear();
+
+    // Calls 'function' with every entry whose key is at least 'start' (greater than it, if 'exclusive'), in
+    // key order, until it returns false.
+    template <typename Function>
+    void scan(std::string_view start, bool exclusive, Function function) const;
+
+private:
+    static std::uint64_t prefix_of(std::string_view key, std::size_t offset);
+    static std::size_t common_prefix(std::string_view a, std::string_view b);
+    static int compare_head(std::string_view sample, std::size_t offset, std::string_view key);
+    static std::size_t separator_size(const Separator &separator);
+    static std::size_t lower_bound(const Leaf &leaf, std::string_view key);
+    static std::size_t child_of(const Inner &inner, std::string_view key);
+    static void set_offset(Leaf &leaf, std::size_t offset);
+    static void refresh(Inner &inner);
+
+    Leaf *find_leaf(std::string_view key, Path *path) const;
+    void insert_child(Path &path, Separator separator, Node *child);
+    void erase_child(Path &path);
+    void free_node(Node *node);
+};
+
+template <typename Function>
+void OrderedIndex::scan(std::string_view start, bool exclusive, Function function) const
+{
+    auto leaf = find_leaf(start, nullptr);
+    auto index = lower_bound(*leaf, start);
+    if (exclusive && index < leaf->count && leaf->items[index].entry->key() == start)
+        index++;
+
+    for (; leaf; leaf = leaf->next, index = 0)
+    {
+        for (; index < leaf->count; index++)
+        {
+            if (!function(*leaf->items[index].entry))
+                return;
+        }
+    }
+}
+
+#endif // !ORDERED_INDEX_HPP_
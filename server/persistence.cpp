@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "cpp_helpers/binary_codec.hpp"
+#include "cpp_helpers/logger.hpp"
+#include "cpp_helpers/string_utility.hpp"
+#include "persistence.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+constexpr std::string_view wal_magic = "KVWAL001";
+constexpr std::string_view snapshot_magic = "KVSNAP01";
+
+// WAL record: [uint32 body size][uint32 body checksum][body]
+// body:       [uint8 PUT_RECORD][uint16 key size][key][uint32 value size][value] or [uint8 DELETE_RECORD][uint16 key size][key]
+constexpr std::size_t record_header_size = 2 * sizeof(std::uint32_t);
+constexpr std::uint8_t put_record = 1;
+constexpr std::uint8_t delete_record = 2;
+
+// Snapshot: [magic][uint64 first WAL generation to replay] then entries [uint8 1][uint16 key size][key][uint32 value size][value]
+// terminated by [uint8 0][uint64 entry count].
+constexpr std::uint8_t snapshot_entry_tag = 1;
+constexpr std::uint8_t snapshot_end_tag = 0;
+
+// FNV-1a; only has to catch a torn or partially written tail record.
+std::uint32_t checksum(std::string_view data)
+{
+    std::uint32_t hash = 2166136261u;
+    for (auto c : data)
+    {
+        hash ^= static_cast<std::uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Grows 'buffer' by 'size' bytes and returns a writer over the new bytes.
+codec::Writer append(std::string &buffer, std::size_t size)
+{
+    auto offset = buffer.size();
+    buffer.resize(offset + size);
+    return codec::Writer(&buffer[offset], size);
+}
+
+std::size_t total_size(const std::string_view *chunks, std::size_t chunk_count)
+{
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < chunk_count; i++)
+        size += chunks[i].size();
+    return size;
+}
+
+// Writes the value given in chunks as one uint32-prefixed string.
+void write_value(codec::Writer &writer, const std::string_view *chunks, std::size_t chunk_count, std::size_t size)
+{
+    writer.write(static_cast<std::uint32_t>(size));
+    for (std::size_t i = 0; i < chunk_count; i++)
+        writer.write_bytes(chunks[i]);
+}
+
+// A PUT record carries a value given in 'chunk_count' chunks, a DELETE record has none.
+void append_record(std::string &buffer, std::uint8_t op, std::string_view key, const std::string_view *chunks, std::size_t chunk_count)
+{
+    auto value_size = total_size(chunks, chunk_count);
+    auto body_size = sizeof(std::uint8_t) + codec::encoded_size(key) + (op == put_record ? sizeof(std::uint32_t) + value_size : 0);
+    // The record length is 32 bits too; the store refuses values above net::max_value_size, which always fit.
+    if (body_size > std::numeric_limits<std::uint32_t>::max())
+        throw std::length_error("record too large for the log");
+    auto offset = buffer.size();
+    auto writer = append(buffer, record_header_size + body_size);
+    std::string_view body(&buffer[offset + record_header_size], body_size);
+
+    codec::Writer body_writer(&buffer[offset + record_header_size], body_size);
+    body_writer.write(op);
+    body_writer.write_string(key);
+    if (op == put_record)
+        write_value(body_writer, chunks, chunk_count, value_size);
+
+    writer.write(static_cast<std::uint32_t>(body_size));
+    writer.write(checksum(body));
+}
+
+bool read_magic(codec::Reader &reader, std::string_view magic)
+{
+    std::string_view data;
+    return reader.read_bytes(data, magic.size()) && data == magic;
+}
+
+// Parses "<prefix><number>" and returns false for anything else.
+bool parse_suffix_number(const std::string &file_name, const std::string &prefix, std::uint64_t &number)
+{
+    if (file_name.size() <= prefix.size() || file_name.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    auto digits = file_name.substr(prefix.size());
+    if (!std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        return false;
+    number = std::stoull(digits);
+    return true;
+}
+} // namespace
+
+Persistence::Persistence(const PersistenceOptions &options, std::size_t shard_index, std::size_t shard_count)
+    : options(options),
+      name(str::format("shard-{}-of-{}", std::to_string(shard_index), std::to_string(shard_count))),
+      shard_count(shard_count),
+      wal_generation(0),
+      wal_unsynced(false),
+      last_sync(Clock::now()),
+      wal_bytes_since_snapshot(0),
+      snapshot_input_done(false),
+      snapshot_aborted(false),
+      snapshot_running(false),
+      snapshot_entries(0)
+{
+    fs::create_directories(options.directory);
+}
+
+Persistence::~Persistence()
+{
+    try
+    {
+        if (wal)
+        {
+            write_wal();
+            sync_wal();
+        }
+    }
+    catch (std::exception &e)
+    {
+        logging::error("Cannot flush the log of ", name, ": ", e.what());
+    }
+
+    if (snapshot_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mutex);
+            snapshot_aborted = !snapshot_input_done;
+            snapshot_input_done = true;
+        }
+        snapshot_cv.notify_one();
+        snapshot_thread.join();
+    }
+}
+
+void Persistence::recover(const PutCallback &put, const DeleteCallback &erase)
+{
+    check_shard_count();
+    fs::remove(snapshot_path() + ".tmp");
+
+    std::uint64_t first_generation = 0;
+    if (fs::exists(snapshot_path()))
+    {
+        MappedFile file(snapshot_path());
+        codec::Reader reader(file.data(), file.size());
+        if (!read_magic(reader, snapshot_magic) || !reader.read(first_generation))
+            throw std::runtime_error("Corrupt snapshot '" + snapshot_path() + "'");
+
+        std::uint64_t entries = 0;
+        std::uint8_t tag;
+        while (reader.read(tag) && tag == snapshot_entry_tag)
+        {
+            std::string_view key, value;
+            if (!reader.read_string(key) || !reader.read_string<std::uint32_t>(value))
+                break;
+            put(key, value);
+            entries++;
+        }
+        std::uint64_t expected_entries;
+        if (!reader.ok() || tag != snapshot_end_tag || !reader.read(expected_entries) || expected_entries != entries)
+            throw std::runtime_error("Corrupt snapshot '" + snapshot_path() + "'");
+    }
+
+    std::vector<std::uint64_t> generations;
+    for (auto &entry : fs::directory_iterator(options.directory))
+    {
+        if (std::uint64_t generation; parse_suffix_number(entry.path().filename().string(), name + ".wal.", generation))
+            generations.push_back(generation);
+    }
+    std::sort(generations.begin(), generations.end());
+
+    std::uint64_t next_generation = first_generation;
+    for (auto generation : generations)
+    {
+        next_generation = std::max(next_generation, generation + 1);
+        if (generation < first_generation)
+            continue;
+
+        MappedFile file(wal_path(generation));
+        codec::Reader reader(file.data(), file.size());
+        if (!read_magic(reader, wal_magic))
+            continue;
+
+        // A record that is cut short or fails its checksum was never acknowledged; replay stops there.
+        while (reader.remaining() >= record_header_size)
+        {
+            std::uint32_t body_size, body_checksum;
+            std::string_view body;
+            reader.read(body_size);
+            reader.read(body_checksum);
+            if (!reader.read_bytes(body, body_size) || checksum(body) != body_checksum)
+                break;
+
+            codec::Reader body_reader(body.data(), body.size());
+            std::uint8_t op;
+            std::string_view key, value;
+            if (!body_reader.read(op) || !body_reader.read_string(key))
+                break;
+            if (op == put_record && body_reader.read_string<std::uint32_t>(value))
+                put(key, value);
+            else if (op == delete_record)
+                erase(key);
+            else
+                break;
+        }
+        wal_bytes_since_snapshot += reader.position();
+    }
+
+    // Always start a fresh generation, so nothing is ever appended behind a torn record.
+    open_wal(next_generation);
+}
+
+void Persistence::log_put(std::string_view key, std::string_view value)
+{
+    log_put(key, &value, 1);
+}
+
+void Persistence::log_put(std::string_view key, const std::vector<std::string_view> &value_chunks)
+{
+    log_put(key, value_chunks.data(), value_chunks.size());
+}
+
+void Persistence::log_put(std::string_view key, const std::string_view *value_chunks, std::size_t chunk_count)
+{
+    append_record(wal_buffer, put_record, key, value_chunks, chunk_count);
+    if (wal_buffer.size() >= options.group_commit_bytes)
+        write_wal();
+}
+
+void Persistence::log_delete(std::string_view key)
+{
+    append_record(wal_buffer, delete_record, key, nullptr, 0);
+    if (wal_buffer.size() >= options.group_commit_bytes)
+        write_wal();
+}
+
+void Persistence::commit()
+{
+    write_wal();
+    if (options.fsync == FsyncPolicy::ALWAYS)
+        sync_wal();
+    else
+        tick();
+}
+
+void Persistence::tick()
+{
+    if (options.fsync == FsyncPolicy::INTERVAL && Clock::now() - last_sync >= options.fsync_interval)
+        sync_wal();
+}
+
+bool Persistence::snapshot_due() const
+{
+    return !snapshot_running && wal_bytes_since_snapshot >= options.snapshot_wal_bytes;
+}
+
+bool Persistence::snapshot_backlogged()
+{
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    return snapshot_chunks.size() >= max_queued_snapshot_chunks;
+}
+
+void Persistence::begin_snapshot()
+{
+    if (snapshot_thread.joinable())
+        snapshot_thread.join();
+
+    // The snapshot covers everything logged so far; the log restarts in a new generation.
+    write_wal();
+    sync_wal();
+    open_wal(wal_generation + 1);
+    wal_bytes_since_snapshot = 0;
+
+    snapshot_chunks.clear();
+    snapshot_chunk.clear();
+    snapshot_entries = 0;
+    snapshot_input_done = false;
+    snapshot_aborted = false;
+    snapshot_running = true;
+    snapshot_thread = std::thread(&Persistence::write_snapshot, this, wal_generation);
+}
+
+void Persistence::snapshot_entry(std::string_view key, std::string_view value)
+{
+    snapshot_entry(key, &value, 1);
+}
+
+void Persistence::snapshot_entry(std::string_view key, const std::vector<std::string_view> &value_chunks)
+{
+    snapshot_entry(key, value_chunks.data(), value_chunks.size());
+}
+
+void Persistence::snapshot_entry(std::string_view key, const std::string_view *value_chunks, std::size_t chunk_count)
+{
+    auto value_size = total_size(value_chunks, chunk_count);
+    auto writer = append(snapshot_chunk, sizeof(std::uint8_t) + codec::encoded_size(key) + sizeof(std::uint32_t) + value_size);
+    writer.write(snapshot_entry_tag);
+    writer.write_string(key);
+    write_value(writer, value_chunks, chunk_count, value_size);
+    snapshot_entries++;
+    if (snapshot_chunk.size() >= snapshot_chunk_size)
+        queue_snapshot_chunk();
+}
+
+void Persistence::end_snapshot()
+{
+    auto writer = append(snapshot_chunk, sizeof(std::uint8_t) + sizeof(std::uint64_t));
+    writer.write(snapshot_end_tag);
+    writer.write(snapshot_entries);
+    queue_snapshot_chunk();
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_input_done = true;
+    }
+    snapshot_cv.notify_one();
+}
+
+void Persistence::wait_for_snapshot()
+{
+    if (snapshot_thread.joinable())
+        snapshot_thread.join();
+}
+
+std::string Persistence::path(const std::string &file_name) const
+{
+    return (fs::path(options.directory) / file_name).string();
+}
+
+std::string Persistence::wal_path(std::uint64_t generation) const
+{
+    return path(name + ".wal." + std::to_string(generation));
+}
+
+std::string Persistence::snapshot_path() const
+{
+    return path(name + ".snapshot");
+}
+
+void Persistence::check_shard_count() const
+{
+    // Keys are assigned to shards by hash modulo the shard count, so files of another count cannot be reused.
+    for (auto &entry : fs::directory_iterator(options.directory))
+    {
+        auto file_name = entry.path().filename().string();
+        if (file_name.compare(0, 6, "shard-") != 0)
+            continue;
+        auto of = file_name.find("-of-");
+        auto dot = file_name.find('.', of);
+        if (of == std::string::npos || dot == std::string::npos)
+            continue;
+        if (file_name.substr(of + 4, dot - of - 4) != std::to_string(shard_count))
+            throw std::runtime_error(str::format("The data directory '{}' was written by a server with a different number of threads ('{}')",
+                                                 options.directory, file_name));
+    }
+}
+
+void Persistence::open_wal(std::uint64_t generation)
+{
+    wal = std::make_unique<AppendFile>(wal_path(generation));
+    wal_generation = generation;
+    if (wal->size() == 0)
+    {
+        wal->append(wal_magic.data(), wal_magic.size());
+        wal->sync();
+        sync_directory(options.directory);
+    }
+}
+
+void Persistence::write_wal()
+{
+    if (wal_buffer.empty())
+        return;
+    wal->append(wal_buffer.data(), wal_buffer.size());
+    wal_bytes_since_snapshot += wal_buffer.size();
+    wal_buffer.clear();
+    wal_unsynced = true;
+}
+
+void Persistence::sync_wal()
+{
+    if (!wal_unsynced)
+        return;
+    wal->sync();
+    wal_unsynced = false;
+    last_sync = Clock::now();
+}
+
+void Persistence::queue_snapshot_chunk()
+{
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_chunks.push_back(std::move(snapshot_chunk));
+    }
+    snapshot_chunk.clear();
+    snapshot_cv.notify_one();
+}
+
+void Persistence::write_snapshot(std::uint64_t first_generation)
+{
+    auto temp_path = snapshot_path() + ".tmp";
+    try
+    {
+        fs::remove(temp_path);
+        {
+            AppendFile file(temp_path);
+            std::string header;
+            header.append(snapshot_magic);
+            append(header, sizeof(std::uint64_t)).write(first_generation);
+            file.append(header.data(), header.size());
+
+            while (true)
+            {
+                std::string chunk;
+                {
+                    std::unique_lock<std::mutex> lock(snapshot_mutex);
+                    snapshot_cv.wait(lock, [this] { return !snapshot_chunks.empty() || snapshot_input_done; });
+                    if (snapshot_aborted)
+                        throw std::runtime_error("aborted");
+                    if (snapshot_chunks.empty())
+                        break;
+                    chunk = std::move(snapshot_chunks.front());
+                    snapshot_chunks.pop_front();
+                }
+                file.append(chunk.data(), chunk.size());
+            }
+            file.sync();
+        }
+        fs::rename(temp_path, snapshot_path());
+        sync_directory(options.directory);
+
+        std::vector<fs::path> replaced;
+        for (auto &entry : fs::directory_iterator(options.directory))
+        {
+            if (std::uint64_t generation; parse_suffix_number(entry.path().filename().string(), name + ".wal.", generation) && generation < first_generation)
+                replaced.push_back(entry.path());
+        }
+        for (auto &file : replaced)
+            fs::remove(file);
+        sync_directory(options.directory);
+    }
+    catch (std::exception &e)
+    {
+        logging::error("The snapshot of ", name, " was not written: ", e.what());
+        std::error_code ignored;
+        fs::remove(temp_path, ignored);
+    }
+    snapshot_running = false;
+}
@@ -0,0 +1,126 @@
+#ifndef PERSISTENCE_HPP_
+#define PERSISTENCE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "file_io.hpp"
+
+enum class FsyncPolicy : std::uint8_t
+{
+    ALWAYS,   // every commit is synced before its replies are sent (group commit)
+    INTERVAL, // at most one sync per fsync_interval
+    NEVER     // left to the operating system
+};
+
+struct PersistenceOptions
+{
+    std::string directory; // persistence is disabled while empty
+    FsyncPolicy fsync = FsyncPolicy::INTERVAL;
+    std::chrono::milliseconds fsync_interval{1000};
+    // Records are buffered in memory until the next commit, or until the buffer grows beyond this.
+    std::size_t group_commit_bytes = 1 << 20;
+    // A snapshot is taken once this many bytes were logged since the last one.
+    std::uint64_t snapshot_wal_bytes = 64ull << 20;
+
+    bool enabled() const { return !directory.empty(); }
+};
+
+// Write-ahead log plus snapshots for one shard.
+//
+// Every mutation is appended to the current WAL generation. A snapshot first switches the log to a new
+// generation and then receives the entries of the store from its owner, a few at a time between request
+// batches, while a background thread writes them out. The store keeps changing while it is walked, so a
+// snapshot is "fuzzy"; it is still exact once the log from its first generation on is replayed over it,
+// because replaying PUT as an upsert and DELETE as erase-if-present converges to the final state.
+// Once the snapshot is durable the generations before it are deleted.
+//
+// Files, for shard i of n: shard-i-of-n.snapshot and shard-i-of-n.wal.<generation>.
+class Persistence
+{
+public:
+    using PutCallback = std::function<void(std::string_view key, std::string_view value)>;
+    using DeleteCallback = std::function<void(std::string_view key)>;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Bytes of snapshot data handed to the writer at once, and how many of those may be queued.
+    static constexpr std::size_t snapshot_chunk_size = 1 << 20;
+    static constexpr std::size_t max_queued_snapshot_chunks = 16;
+
+    PersistenceOptions options;
+    std::string name;
+    std::size_t shard_count;
+
+    std::uint64_t wal_generation;
+    std::unique_ptr<AppendFile> wal;
+    std::string wal_buffer;
+    bool wal_unsynced;
+    Clock::time_point last_sync;
+    std::uint64_t wal_bytes_since_snapshot;
+
+    std::thread snapshot_thread;
+    std::mutex snapshot_mutex;
+    std::condition_variable snapshot_cv;
+    std::deque<std::string> snapshot_chunks;
+    bool snapshot_input_done;
+    bool snapshot_aborted;
+    std::atomic_bool snapshot_running;
+    std::string snapshot_chunk;
+    std::uint64_t snapshot_entries;
+
+public:
+    Persistence(const PersistenceOptions &options, std::size_t shard_index, std::size_t shard_count);
+    ~Persistence();
+
+    Persistence(const Persistence &) = delete;
+    Persistence &operator=(const Persistence &) = delete;
+
+    // Loads the latest snapshot and replays the log after it, then opens a new log generation.
+    // Throws when the directory holds data written with a different number of shards.
+    void recover(const PutCallback &put, const DeleteCallback &erase);
+
+    void log_put(std::string_view key, std::string_view value);
+    // A value kept in several pieces, written as one.
+    void log_put(std::string_view key, const std::vector<std::string_view> &value_chunks);
+    void log_delete(std::string_view key);
+    // Writes the records logged since the last commit and syncs them according to the fsync policy.
+    void commit();
+    // Syncs pending records once the fsync interval has passed; call it regularly, even when idle.
+    void tick();
+
+    bool snapshot_due() const;
+    bool snapshot_in_progress() const { return snapshot_running; }
+    // True while the writer is behind; the owner should hold back further entries.
+    bool snapshot_backlogged();
+    void begin_snapshot();
+    void snapshot_entry(std::string_view key, std::string_view value);
+    void snapshot_entry(std::string_view key, const std::vector<std::string_view> &value_chunks);
+    void end_snapshot();
+    void wait_for_snapshot();
+
+private:
+    std::string path(const std::string &file_name) const;
+    std::string wal_path(std::uint64_t generation) const;
+    std::string snapshot_path() const;
+    void check_shard_count() const;
+    void log_put(std::string_view key, const std::string_view *value_chunks, std::size_t chunk_count);
+    void snapshot_entry(std::string_view key, const std::string_view *value_chunks, std::size_t chunk_count);
+    void open_wal(std::uint64_t generation);
+    void write_wal();
+    void sync_wal();
+    void queue_snapshot_chunk();
+    void write_snapshot(std::uint64_t first_generation);
+};
+
+#endif // !PERSISTENCE_HPP_
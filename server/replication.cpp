@@ -0,0 +1,294 @@
+#include <chrono>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "cpp_helpers/logger.hpp"
+#include "replication.hpp"
+
+namespace
+{
+// Batches compare the wall clocks of two machines, which the monotonic clock of TimeStamp cannot do.
+std::uint64_t wall_clock_ns()
+{
+    auto epoch = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(epoch).count());
+}
+
+zmq::message_t encode_batch(const net::ReplicationBatch &batch)
+{
+    zmq::message_t message(batch.encoded_size());
+    codec::Writer writer(message.data(), message.size());
+    batch.encode(writer);
+    if (!writer.ok())
+        throw std::length_error("replication batch exceeds the wire format limits");
+    return message;
+}
+} // namespace
+
+ReplicationLog::ReplicationLog(const ReplicationOptions &options, std::size_t shard_index, std::size_t shard_count)
+    : last_batch_time(0)
+{
+    header.epoch = options.epoch;
+    header.shard = static_cast<std::uint16_t>(shard_index);
+    header.shard_count = static_cast<std::uint16_t>(shard_count);
+}
+
+void ReplicationLog::log_put(std::string_view key, std::string_view value)
+{
+    append_mutation(net::MutationType::PUT_MUTATION, key, &value, 1);
+}
+
+void ReplicationLog::log_put(std::string_view key, const std::vector<std::string_view> &value_chunks)
+{
+    append_mutation(net::MutationType::PUT_MUTATION, key, value_chunks.data(), value_chunks.size());
+}
+
+void ReplicationLog::log_delete(std::string_view key)
+{
+    append_mutation(net::MutationType::DELETE_MUTATION, key, nullptr, 0);
+}
+
+void ReplicationLog::append_mutation(net::MutationType type, std::string_view key, const std::string_view *value_chunks, std::size_t chunk_count)
+{
+    std::size_t value_size = 0;
+    for (std::size_t i = 0; i < chunk_count; i++)
+        value_size += value_chunks[i].size();
+    if (value_size > std::numeric_limits<net::ValueLength>::max())
+        throw std::length_error("value too large for the replication stream");
+
+    auto offset = mutations.size();
+    auto size = sizeof(std::uint8_t) + codec::encoded_size(key) + (type == net::MutationType::PUT_MUTATION ? sizeof(net::ValueLength) + value_size : 0);
+    mutations.resize(offset + size);
+    codec::Writer writer(&mutations[offset], size);
+    writer.write(static_cast<std::uint8_t>(type));
+    writer.write_string(key);
+    if (type == net::MutationType::PUT_MUTATION)
+    {
+        writer.write(static_cast<net::ValueLength>(value_size));
+        for (std::size_t i = 0; i < chunk_count; i++)
+            writer.write_bytes(value_chunks[i]);
+    }
+    header.count++;
+}
+
+zmq::message_t ReplicationLog::take_batch()
+{
+    auto now = TimeStamp::now();
+    if (header.count == 0 && now - last_batch_time < heartbeat_interval_ns)
+        return zmq::message_t();
+
+    header.time = wall_clock_ns();
+    zmq::message_t batch(net::ReplicationHeader::encoded_size + mutations.size());
+    codec::Writer writer(batch.data(), batch.size());
+    header.encode(writer);
+    writer.write_bytes(mutations);
+
+    header.sequence += header.count;
+    header.count = 0;
+    // A batch with a large value should not pin its size for good.
+    if (mutations.capacity() > net::value_chunk_size)
+        mutations = std::string();
+    mutations.clear();
+    last_batch_time = now;
+    return batch;
+}
+
+ReplicationPublisher::ReplicationPublisher(const ReplicationOptions &options)
+    : socket(net::Context::instance().create_socket(ZMQ_PUB))
+{
+    int limit = max_queued_batches;
+    socket->setsockopt(ZMQ_SNDHWM, limit);
+    socket->bind(options.endpoint);
+}
+
+void ReplicationPublisher::publish(zmq::message_t &batch)
+{
+    socket->send(batch, ZMQ_NOBLOCK);
+}
+
+ReplicationSubscriber::ReplicationSubscriber(const ReplicationOptions &options)
+    : options(options),
+      stream_socket(net::Context::instance().create_socket(ZMQ_SUB)),
+      primary_socket(net::Context::instance().create_socket(ZMQ_DEALER)),
+      state(State::CONNECTING),
+      epoch(0),
+      after_cursor(false),
+      scan_id(0),
+      scan_sent(0),
+      snapshot_items(0),
+      last_contact(0),
+      resyncs(0)
+{
+    // Batches are only ever lost on the primary's side, where a gap is noticed.
+    int no_limit = 0;
+    stream_socket->setsockopt(ZMQ_RCVHWM, no_limit);
+    stream_socket->setsockopt(ZMQ_SUBSCRIBE, "", 0);
+    stream_socket->connect(options.endpoint);
+    primary_socket->connect(options.primary);
+    logging::info("Replicating ", options.primary, " from ", options.endpoint, ".");
+}
+
+void ReplicationSubscriber::receive(std::vector<zmq::message_t> &batches)
+{
+    for (std::size_t handled = 0; handled < max_batch_size; handled++)
+    {
+        zmq::message_t message;
+        if (!stream_socket->recv(&message, ZMQ_NOBLOCK))
+            break;
+        receive_stream(message, batches);
+    }
+
+    for (;;)
+    {
+        zmq::message_t message;
+        net::Frames frames;
+        if (!primary_socket->recv(&message, ZMQ_NOBLOCK))
+            break;
+        net::receive_more(*primary_socket, message, frames);
+        receive_page(message, batches);
+    }
+
+    if (state == State::SYNCING && TimeStamp::now() - scan_sent > scan_timeout_ns)
+    {
+        logging::warning("No snapshot page from ", options.primary, " in time; asking again.");
+        request_page();
+    }
+}
+
+void ReplicationSubscriber::receive_stream(zmq::message_t &message, std::vector<zmq::message_t> &batches)
+{
+    codec::Reader reader(message.data(), message.size());
+    net::ReplicationHeader header;
+    if (!header.decode(reader) || header.shard >= header.shard_count || (header.flags & net::replication_snapshot) != 0)
+    {
+        logging::warning("A malformed replication batch was dropped.");
+        return;
+    }
+    last_contact = TimeStamp::now();
+
+    if (!track(header))
+    {
+        if (!shards.empty())
+            start_over(header.epoch != epoch ? "the primary restarted" : "batches were lost");
+        epoch = header.epoch;
+        shards.assign(header.shard_count, ShardProgress());
+        track(header);
+    }
+
+    if (state == State::LIVE)
+    {
+        batches.push_back(std::move(message));
+        return;
+    }
+    collected.push_back(std::move(message));
+    if (state == State::SYNCING)
+        return;
+    for (auto &shard : shards)
+    {
+        if (!shard.seen)
+            return;
+    }
+
+    // Every shard of the primary is heard from, so nothing it publishes from now on is missed.
+    net::ReplicationBatch reset;
+    reset.header.epoch = epoch;
+    reset.header.flags = net::replication_reset;
+    batches.push_back(encode_batch(reset));
+    state = State::SYNCING;
+    cursor.clear();
+    after_cursor = false;
+    snapshot_items = 0;
+    request_page();
+}
+
+void ReplicationSubscriber::receive_page(const zmq::message_t &message, std::vector<zmq::message_t> &batches)
+{
+    codec::Reader reader(message.data(), message.size());
+    net::ResponseMessage response;
+    net::ScanResponseData page;
+    // Replies to pages asked for before a restart, or asked for again, are ignored.
+    if (!response.decode(reader) || state != State::SYNCING || response.id != scan_id)
+        return;
+    if (static_cast<net::NetworkResponse>(response.data_type) != net::NetworkResponse::SCAN_RESULT || !page.decode(reader))
+    {
+        logging::error("The primary ", options.primary, " sent no snapshot page.");
+        return;
+    }
+
+    net::ReplicationBatch batch;
+    batch.header.epoch = epoch;
+    batch.header.flags = net::replication_snapshot;
+    batch.header.count = static_cast<std::uint32_t>(page.items.size());
+    for (auto &[key, value] : page.items)
+        batch.mutations.push_back({net::MutationType::PUT_MUTATION, key, value});
+    batches.push_back(encode_batch(batch));
+    snapshot_items += page.items.size();
+
+    if (page.more && !page.items.empty())
+    {
+        cursor = page.items.back().first;
+        after_cursor = true;
+        request_page();
+        return;
+    }
+
+    logging::info("Replication snapshot of ", snapshot_items, " items loaded, ", collected.size(), " batches to replay.");
+    for (auto &collected_batch : collected)
+        batches.push_back(std::move(collected_batch));
+    collected.clear();
+    state = State::LIVE;
+}
+
+// Checks that the batch continues the numbering of its shard, and takes note of it.
+bool ReplicationSubscriber::track(const net::ReplicationHeader &header)
+{
+    if (header.epoch != epoch || header.shard_count != shards.size())
+        return false;
+    auto &shard = shards[header.shard];
+    if (shard.seen && header.sequence != shard.next_sequence)
+        return false;
+    auto now = wall_clock_ns();
+    shard.seen = true;
+    shard.next_sequence = header.sequence + header.count;
+    shard.batch_time = header.time;
+    shard.lag_ns = now > header.time ? now - header.time : 0;
+    return true;
+}
+
+void ReplicationSubscriber::start_over(const char *reason)
+{
+    logging::warning("Replication starts over: ", reason, ".");
+    state = State::CONNECTING;
+    collected.clear();
+    shards.clear();
+    // A page still on its way belongs to the old snapshot.
+    scan_id++;
+    resyncs++;
+}
+
+void ReplicationSubscriber::request_page()
+{
+    scan_id++;
+    net::ScanCommand cmd({}, {}, snapshot_page_size, after_cursor ? net::scan_with_values | net::scan_after_cursor : net::scan_with_values, cursor);
+    auto message = net::encode_command(scan_id, cmd);
+    // Sending fails while the primary is not connected yet; the timeout asks again.
+    primary_socket->send(message, ZMQ_NOBLOCK);
+    scan_sent = TimeStamp::now();
+}
+
+std::string ReplicationSubscriber::stats_text() const
+{
+    std::ostringstream text;
+    auto seconds = [](std::uint64_t ns) { return static_cast<double>(ns) / 1e9; };
+    text << "kv_replication_state " << static_cast<int>(state) << '\n'
+         << "kv_replication_resyncs_total " << resyncs << '\n'
+         << "kv_replication_snapshot_items " << snapshot_items << '\n'
+         << "kv_replication_last_contact_seconds " << (last_contact ? seconds(TimeStamp::now() - last_contact) : -1.0) << '\n';
+    for (std::size_t i = 0; i < shards.size(); i++)
+    {
+        auto labels = "primary_shard=\"" + std::to_string(i) + "\"";
+        text << "kv_replication_sequence{" << labels << "} " << shards[i].next_sequence << '\n'
+             << "kv_replication_lag_seconds{" << labels << "} " << seconds(shards[i].lag_ns) << '\n';
+    }
+    return text.str();
+}
@@ -0,0 +1,138 @@
+#ifndef REPLICATION_HPP_
+#define REPLICATION_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "cpp_helpers/network_message.hpp"
+
+struct ReplicationOptions
+{
+    // A primary publishes its mutations here; a replica reads them from here. Replication is disabled while empty.
+    std::string endpoint;
+    // Set on a replica: the client endpoint of the primary, from which the snapshot is read.
+    std::string primary;
+    // Identifies the run of a primary; set at startup.
+    std::uint64_t epoch = 0;
+
+    bool enabled() const { return !endpoint.empty(); }
+    bool replica() const { return !primary.empty(); }
+    bool publishes() const { return enabled() && !replica(); }
+};
+
+// The mutations one shard of a primary made since its last batch, encoded as they happen: a value may be
+// gone by the time the batch leaves.
+class ReplicationLog
+{
+private:
+    // A shard without mutations sends an empty batch at least this often.
+    static constexpr std::uint64_t heartbeat_interval_ns = 100'000'000;
+
+    net::ReplicationHeader header;
+    std::string mutations;
+    std::uint64_t last_batch_time;
+
+public:
+    ReplicationLog(const ReplicationOptions &options, std::size_t shard_index, std::size_t shard_count);
+
+    void log_put(std::string_view key, std::string_view value);
+    // A value kept in several pieces, sent as one.
+    void log_put(std::string_view key, const std::vector<std::string_view> &value_chunks);
+    void log_delete(std::string_view key);
+
+    // The mutations logged since the last batch, or a heartbeat when it is due; an empty message otherwise.
+    zmq::message_t take_batch();
+    // The number the next mutation gets.
+    std::uint64_t sequence() const { return header.sequence + header.count; }
+
+private:
+    void append_mutation(net::MutationType type, std::string_view key, const std::string_view *value_chunks, std::size_t chunk_count);
+};
+
+// The primary side of the stream: publishes the batches of all shards on a PUB socket. A replica that
+// falls so far behind that its queue overflows loses batches, notices the gap and synchronizes again.
+class ReplicationPublisher
+{
+private:
+    static constexpr int max_queued_batches = 100000;
+
+    std::unique_ptr<zmq::socket_t> socket;
+
+public:
+    ReplicationPublisher(const ReplicationOptions &options);
+
+    void publish(zmq::message_t &batch);
+};
+
+// The replica side. It subscribes to the stream first and waits until it has heard from every shard of the
+// primary, keeping what arrives. Then it reads a snapshot of the primary with paged SCANs while it keeps
+// collecting the stream, and finally replays the collected batches and follows the stream live. The
+// snapshot is fuzzy, as the primary changes while it is read, but replaying every mutation since before it
+// began over it converges to the primary's state, just like a WAL replayed over a snapshot.
+// A gap in the numbering or a restarted primary starts it all over.
+//
+// Everything it receives is turned into batches for the owner to apply, in order, to its shards.
+class ReplicationSubscriber
+{
+private:
+    enum class State : std::uint8_t
+    {
+        CONNECTING,
+        SYNCING,
+        LIVE
+    };
+
+    struct ShardProgress
+    {
+        bool seen = false;
+        std::uint64_t next_sequence = 0;
+        // Wall clock of the primary when the last batch applied was sent.
+        std::uint64_t batch_time = 0;
+        std::uint64_t lag_ns = 0;
+    };
+
+    static constexpr std::size_t max_batch_size = 4096;
+    static constexpr std::uint32_t snapshot_page_size = 256;
+    // A snapshot page asked for this long ago without a reply is asked for again.
+    static constexpr std::uint64_t scan_timeout_ns = 5'000'000'000;
+
+    ReplicationOptions options;
+    std::unique_ptr<zmq::socket_t> stream_socket;
+    std::unique_ptr<zmq::socket_t> primary_socket;
+    State state;
+    std::uint64_t epoch;
+    std::vector<ShardProgress> shards;
+    // Batches of the stream that arrived before the snapshot was complete.
+    std::vector<zmq::message_t> collected;
+    std::string cursor;
+    bool after_cursor;
+    net::RequestId scan_id;
+    std::uint64_t scan_sent;
+    std::uint64_t snapshot_items;
+    std::uint64_t last_contact;
+    std::uint64_t resyncs;
+
+public:
+    ReplicationSubscriber(const ReplicationOptions &options);
+
+    void *stream_handle() { return static_cast<void *>(*stream_socket); }
+    void *primary_handle() { return static_cast<void *>(*primary_socket); }
+    bool live() const { return state == State::LIVE; }
+
+    // Takes whatever arrived and appends the batches to apply to 'batches'. Call it whenever one of the
+    // sockets is readable, and regularly anyway.
+    void receive(std::vector<zmq::message_t> &batches);
+    // Replication state and lag in the format of STATS.
+    std::string stats_text() const;
+
+private:
+    void receive_stream(zmq::message_t &message, std::vector<zmq::message_t> &batches);
+    void receive_page(const zmq::message_t &message, std::vector<zmq::message_t> &batches);
+    bool track(const net::ReplicationHeader &header);
+    void start_over(const char *reason);
+    void request_page();
+};
+
+#endif // !REPLICATION_HPP_
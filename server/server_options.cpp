@@ -0,0 +1,78 @@
+#include <stdexcept>
+#include "cpp_helpers/networking.hpp"
+#include "server_options.hpp"
+
+ServerOptions ServerOptions::parse(int argc, char *argv[])
+{
+    if (argc < 2)
+        throw std::invalid_argument("missing port or endpoint");
+
+    ServerOptions options;
+    std::string address = argv[1];
+    if (address.find("://") != std::string::npos)
+        options.endpoints.push_back(address);
+    else
+        options.endpoints.push_back(net::endpoint(net::TCP, "*", static_cast<net::Port>(std::stoi(address))));
+    for (int i = 2; i < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+            throw std::invalid_argument("missing value for " + option);
+        std::string value = argv[i + 1];
+
+        if (option == "--listen")
+            options.endpoints.push_back(value);
+        else if (option == "--threads")
+            options.threads = std::stoul(value);
+        else if (option == "--data-dir")
+            options.persistence.directory = value;
+        else if (option == "--fsync")
+        {
+            if (value == "always")
+                options.persistence.fsync = FsyncPolicy::ALWAYS;
+            else if (value == "interval")
+                options.persistence.fsync = FsyncPolicy::INTERVAL;
+            else if (value == "never")
+                options.persistence.fsync = FsyncPolicy::NEVER;
+            else
+                throw std::invalid_argument("unknown fsync policy " + value);
+        }
+        else if (option == "--fsync-interval-ms")
+            options.persistence.fsync_interval = std::chrono::milliseconds(std::stoul(value));
+        else if (option == "--group-commit-bytes")
+            options.persistence.group_commit_bytes = std::stoul(value);
+        else if (option == "--snapshot-wal-bytes")
+            options.persistence.snapshot_wal_bytes = std::stoull(value);
+        else if (option == "--max-memory")
+            options.eviction.max_memory = std::stoull(value);
+        else if (option == "--eviction")
+            options.eviction.policy = EvictionPolicy::parse(value);
+        else if (option == "--replication")
+            options.replication.endpoint = value;
+        else if (option == "--replica-of")
+            options.replication.primary = value;
+        else if (option == "--log-level")
+            options.log_level = logging::Logger::parse_level(value);
+        else
+            throw std::invalid_argument("unknown option " + option);
+    }
+
+    if (options.threads == 0)
+        throw std::invalid_argument("--threads must be at least 1");
+    if (options.replication.replica() && !options.replication.enabled())
+        throw std::invalid_argument("--replica-of needs the --replication endpoint of the primary");
+    // A replica loads everything from its primary whenever it starts.
+    if (options.replication.replica() && options.persistence.enabled())
+        throw std::invalid_argument("a replica keeps no --data-dir");
+    return options;
+}
+
+std::string ServerOptions::usage()
+{
+    return "Usage: server <port|endpoint> [--listen ENDPOINT]... [--threads N]\n"
+           "                     [--data-dir DIR] [--fsync always|interval|never] [--fsync-interval-ms MS]\n"
+           "                     [--group-commit-bytes BYTES] [--snapshot-wal-bytes BYTES]\n"
+           "                     [--max-memory BYTES] [--eviction lru|clock|lfu]\n"
+           "                     [--replication ENDPOINT] [--replica-of ENDPOINT]\n"
+           "                     [--log-level debug|info|warning|error|off]\n";
+}
@@ -0,0 +1,27 @@
+#ifndef SERVER_OPTIONS_HPP_
+#define SERVER_OPTIONS_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cpp_helpers/logger.hpp"
+#include "eviction_policy.hpp"
+#include "persistence.hpp"
+#include "replication.hpp"
+
+struct ServerOptions
+{
+    // Where clients connect: tcp://*:<port> for a plain port, plus any tcp://, ipc:// or inproc:// endpoints.
+    std::vector<std::string> endpoints;
+    std::size_t threads = 1;
+    PersistenceOptions persistence;
+    EvictionOptions eviction;
+    ReplicationOptions replication;
+    logging::Level log_level = logging::Level::info;
+
+    // Parses the command line of the server; throws std::invalid_argument when it is malformed.
+    static ServerOptions parse(int argc, char *argv[]);
+    static std::string usage();
+};
+
+#endif // !SERVER_OPTIONS_HPP_
@@ -0,0 +1,156 @@
+#include <atomic>
+#include "shard_worker.hpp"
+
+namespace
+{
+// Inproc names are global to the process, which may run several servers.
+std::atomic<std::size_t> next_pipe(0);
+} // namespace
+
+ShardWorker::ShardWorker(std::size_t index, std::size_t count, const PersistenceOptions &persistence_options, const EvictionOptions &eviction_options,
+                         const ReplicationOptions &replication_options)
+    : shard(index, count, persistence_options, eviction_options, replication_options),
+      front_socket(net::Context::instance().create_socket(ZMQ_PAIR)),
+      worker_socket(net::Context::instance().create_socket(ZMQ_PAIR))
+{
+    // Unlimited queues: a request is never dropped between the front-end and its shard.
+    int no_limit = 0;
+    front_socket->setsockopt(ZMQ_SNDHWM, no_limit);
+    front_socket->setsockopt(ZMQ_RCVHWM, no_limit);
+    worker_socket->setsockopt(ZMQ_SNDHWM, no_limit);
+    worker_socket->setsockopt(ZMQ_RCVHWM, no_limit);
+
+    auto address = str::format("inproc://kv-shard-{}-{}", std::to_string(index), std::to_string(next_pipe++));
+    front_socket->bind(address);
+    worker_socket->connect(address);
+    thread = std::thread(&ShardWorker::work, this);
+}
+
+ShardWorker::~ShardWorker()
+{
+    // A lone frame, without the rest of the envelope, tells the worker to stop.
+    front_socket->send("", 0);
+    if (thread.joinable())
+        thread.join();
+}
+
+void ShardWorker::wait_until_ready()
+{
+    ready.get_future().get();
+}
+
+void ShardWorker::forward(zmq::message_t &ticket, zmq::message_t &identity, zmq::message_t &request, net::Frames &frames)
+{
+    front_socket->send(ticket, ZMQ_SNDMORE | ZMQ_NOBLOCK);
+    front_socket->send(identity, ZMQ_SNDMORE | ZMQ_NOBLOCK);
+    front_socket->send(request, frames.empty() ? ZMQ_NOBLOCK : ZMQ_SNDMORE | ZMQ_NOBLOCK);
+    net::send_more(*front_socket, frames, ZMQ_NOBLOCK);
+}
+
+bool ShardWorker::receive(zmq::message_t &ticket, zmq::message_t &identity, zmq::message_t &reply, net::Frames &frames)
+{
+    if (!front_socket->recv(&ticket, ZMQ_NOBLOCK))
+        return false;
+    if (!front_socket->recv(&identity, ZMQ_NOBLOCK) || !front_socket->recv(&reply, ZMQ_NOBLOCK))
+        return false;
+    net::receive_more(*front_socket, reply, frames);
+    return true;
+}
+
+void ShardWorker::send_replication_batch()
+{
+    auto batch = shard.take_replication_batch();
+    if (batch.size() == 0)
+        return;
+    worker_socket->send("", 0, ZMQ_SNDMORE);
+    worker_socket->send("", 0, ZMQ_SNDMORE);
+    worker_socket->send(batch);
+}
+
+// The INVALIDATE pushes go out after the replies of the same batch.
+void ShardWorker::take_invalidations(std::vector<Reply> &replies)
+{
+    std::vector<InvalidationTracker::Push> pushes;
+    shard.take_invalidations(pushes);
+    for (auto &push : pushes)
+        replies.push_back({zmq::message_t(), std::move(push.identity), std::move(push.message), {}});
+}
+
+void ShardWorker::send_replies(std::vector<Reply> &replies)
+{
+    for (auto &reply : replies)
+    {
+        worker_socket->send(reply.ticket, ZMQ_SNDMORE);
+        worker_socket->send(reply.identity, ZMQ_SNDMORE);
+        worker_socket->send(reply.data, reply.frames.empty() ? 0 : ZMQ_SNDMORE);
+        net::send_more(*worker_socket, reply.frames);
+    }
+    replies.clear();
+}
+
+void ShardWorker::work()
+{
+    // Shards recover in parallel, each on its own thread.
+    try
+    {
+        shard.recover();
+        ready.set_value();
+    }
+    catch (...)
+    {
+        ready.set_exception(std::current_exception());
+        zmq::message_t ticket;
+        while (worker_socket->recv(&ticket) && ticket.more())
+            ;
+        worker_socket->close();
+        return;
+    }
+
+    std::vector<Reply> replies;
+    zmq::pollitem_t items[] = {{static_cast<void *>(*worker_socket), 0, ZMQ_POLLIN, 0}};
+    bool stopping = false;
+    while (!stopping)
+    {
+        if (net::poll(items, 1, shard.poll_timeout_ms(poll_timeout_ms)))
+        {
+            for (std::size_t handled = 0; handled < max_batch_size; handled++)
+            {
+                zmq::message_t ticket;
+                if (!worker_socket->recv(&ticket, ZMQ_NOBLOCK))
+                    break;
+                if (!ticket.more())
+                {
+                    stopping = true;
+                    break;
+                }
+
+                zmq::message_t identity, request, reply;
+                net::Frames value_frames, reply_frames;
+                worker_socket->recv(&identity);
+                worker_socket->recv(&request);
+                net::receive_more(*worker_socket, request, value_frames);
+                if (identity.size() == 0)
+                {
+                    shard.apply_replication_batch(request);
+                    continue;
+                }
+                // Every shard answers a batch, even a malformed one, so the front-end never waits for a missing part.
+                if (shard.handle_request(identity, request, value_frames, reply, reply_frames) || ticket.size() > 0)
+                    replies.push_back({std::move(ticket), std::move(identity), std::move(reply), std::move(reply_frames)});
+            }
+
+            // Group commit: the whole batch is made durable before any of its replies leaves.
+            shard.commit();
+            take_invalidations(replies);
+            send_replication_batch();
+            send_replies(replies);
+        }
+        shard.tick();
+        send_replication_batch();
+        // Clients whose tracking expired are told to drop their cached keys.
+        take_invalidations(replies);
+        send_replies(replies);
+    }
+    shard.print_stats();
+    worker_socket->close();
+}
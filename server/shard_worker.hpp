@@ -0,0 +1,60 @@
+#ifndef SHARD_WORKER_HPP_
+#define SHARD_WORKER_HPP_
+
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "cpp_helpers/networking.hpp"
+#include "key_value_shard.hpp"
+
+// Runs one KeyValueShard on its own thread. The front-end talks to it over a pair of inproc sockets:
+// requests arrive as [ticket][identity][request][value frames...] and replies leave as
+// [ticket][identity][reply][value frames...], so the front-end can route every reply back to the client
+// that asked for it. The ticket is empty for requests sent to a single shard and identifies the pending
+// gather for requests sent to several shards. Value frames only follow single-key requests and replies.
+// Replication batches travel with an empty ticket and an empty identity, which no client has: the worker
+// of a primary sends the batches of its shard to be published, and a replica forwards the batches it
+// receives to every worker to be applied.
+class ShardWorker
+{
+private:
+    struct Reply
+    {
+        zmq::message_t ticket;
+        zmq::message_t identity;
+        zmq::message_t data;
+        net::Frames frames;
+    };
+
+    static constexpr std::size_t max_batch_size = 4096;
+    static constexpr long poll_timeout_ms = 100;
+
+    KeyValueShard shard;
+    std::unique_ptr<zmq::socket_t> front_socket;
+    std::unique_ptr<zmq::socket_t> worker_socket;
+    std::promise<void> ready;
+    std::thread thread;
+
+public:
+    ShardWorker(std::size_t index, std::size_t count, const PersistenceOptions &persistence_options, const EvictionOptions &eviction_options,
+                const ReplicationOptions &replication_options);
+    ~ShardWorker();
+
+    // Blocks until the shard has recovered its data; rethrows the error if recovery failed.
+    void wait_until_ready();
+
+    void *handle() { return static_cast<void *>(*front_socket); }
+
+    // Front-end side, never blocks.
+    void forward(zmq::message_t &ticket, zmq::message_t &identity, zmq::message_t &request, net::Frames &frames);
+    bool receive(zmq::message_t &ticket, zmq::message_t &identity, zmq::message_t &reply, net::Frames &frames);
+
+private:
+    void work();
+    void take_invalidations(std::vector<Reply> &replies);
+    void send_replies(std::vector<Reply> &replies);
+    void send_replication_batch();
+};
+
+#endif // !SHARD_WORKER_HPP_
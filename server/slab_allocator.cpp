@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <new>
+#include "slab_allocator.hpp"
+
+namespace
+{
+std::size_t round_up(std::size_t size, std::size_t multiple)
+{
+    return (size + multiple - 1) / multiple * multiple;
+}
+} // namespace
+
+SlabAllocator::SlabAllocator()
+    : used_classes(0),
+      slab_bytes(0),
+      large_bytes(0)
+{
+    // Classes grow by 16 bytes while that is finer than 25%, then by 25%: at most ~20% of a block is wasted.
+    std::size_t size = alignment;
+    while (used_classes < class_count && size < max_class_size)
+    {
+        classes[used_classes++].block_size = size;
+        size = round_up(std::max(size + alignment, size + size / 4), alignment);
+    }
+    classes[used_classes++].block_size = max_class_size;
+}
+
+void *SlabAllocator::allocate(std::size_t size)
+{
+    if (size > max_class_size)
+    {
+        large_bytes += size;
+        return ::operator new(size);
+    }
+
+    auto &size_class = classes[class_of(size)];
+    if (size_class.free_list)
+    {
+        auto block = size_class.free_list;
+        size_class.free_list = block->next;
+        return block;
+    }
+    if (size_class.bump == size_class.bump_end)
+    {
+        auto slab_size = std::max(min_slab_size, size_class.block_size * blocks_per_slab);
+        slab_size -= slab_size % size_class.block_size;
+        slabs.push_back(std::unique_ptr<char[]>(new char[slab_size]));
+        slab_bytes += slab_size;
+        size_class.bump = slabs.back().get();
+        size_class.bump_end = size_class.bump + slab_size;
+    }
+    auto block = size_class.bump;
+    size_class.bump += size_class.block_size;
+    return block;
+}
+
+void SlabAllocator::deallocate(void *block, std::size_t size)
+{
+    if (size > max_class_size)
+    {
+        large_bytes -= size;
+        ::operator delete(block);
+        return;
+    }
+
+    auto &size_class = classes[class_of(size)];
+    auto free_block = static_cast<FreeBlock *>(block);
+    free_block->next = size_class.free_list;
+    size_class.free_list = free_block;
+}
+
+std::size_t SlabAllocator::block_size(std::size_t size) const
+{
+    return size > max_class_size ? size : classes[class_of(size)].block_size;
+}
+
+void SlabAllocator::clear()
+{
+    // Large blocks are owned by their users, which must have freed them already.
+    for (std::size_t i = 0; i < used_classes; i++)
+    {
+        classes[i].free_list = nullptr;
+        classes[i].bump = classes[i].bump_end = nullptr;
+    }
+    slabs.clear();
+    slab_bytes = 0;
+}
+
+std::size_t SlabAllocator::class_of(std::size_t size) const
+{
+    auto begin = classes.begin(), end = classes.begin() + used_classes;
+    return std::lower_bound(begin, end, size, [](const SizeClass &size_class, std::size_t size) { return size_class.block_size < size; }) - begin;
+}
@@ -0,0 +1,67 @@
+#ifndef SLAB_ALLOCATOR_HPP_
+#define SLAB_ALLOCATOR_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Hands out blocks from a fixed set of size classes, each carved out of large slabs, so small objects
+// neither pay a heap header each nor fragment the heap. Freed blocks go to a per-class free list and
+// are reused by the next allocation of that class; slab memory is only released with the allocator.
+// Blocks larger than the largest class come straight from the heap.
+class SlabAllocator
+{
+public:
+    static constexpr std::size_t alignment = 16;
+    static constexpr std::size_t max_class_size = 32 * 1024;
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    struct SizeClass
+    {
+        std::size_t block_size = 0;
+        FreeBlock *free_list = nullptr;
+        char *bump = nullptr;
+        char *bump_end = nullptr;
+    };
+
+    static constexpr std::size_t class_count = 40;
+    static constexpr std::size_t min_slab_size = 64 * 1024;
+    static constexpr std::size_t blocks_per_slab = 8;
+
+    std::array<SizeClass, class_count> classes;
+    std::size_t used_classes;
+    std::vector<std::unique_ptr<char[]>> slabs;
+    std::size_t slab_bytes;
+    std::size_t large_bytes;
+
+public:
+    SlabAllocator();
+    ~SlabAllocator() = default;
+
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    // 'size' must be the same for the allocation and the deallocation of a block.
+    void *allocate(std::size_t size);
+    void deallocate(void *block, std::size_t size);
+
+    // The usable size of a block allocated for 'size' bytes.
+    std::size_t block_size(std::size_t size) const;
+    // Bytes taken from the heap: all slabs plus the large blocks.
+    std::size_t allocated_bytes() const { return slab_bytes + large_bytes; }
+
+    // Drops every block at once.
+    void clear();
+
+private:
+    std::size_t class_of(std::size_t size) const;
+};
+
+#endif // !SLAB_ALLOCATOR_HPP_
@@ -0,0 +1,153 @@
+#include <cerrno>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "embedded_server.hpp"
+#include "key_value_client.hpp"
+
+namespace
+{
+int failures = 0;
+
+void check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED: " << what << '\n';
+        failures++;
+    }
+}
+
+KeyValueClient::Response wait(std::future<KeyValueClient::Response> future)
+{
+    if (future.wait_for(std::chrono::seconds(10)) != std::future_status::ready)
+        throw std::runtime_error("the server did not answer");
+    return future.get();
+}
+
+ServerOptions server_options(const std::string &endpoint, std::size_t threads)
+{
+    ServerOptions options;
+    options.endpoints.push_back(endpoint);
+    options.threads = threads;
+    return options;
+}
+
+// The port of a stopped server is only free once its socket has been closed in the background.
+std::unique_ptr<EmbeddedServer> restart_server(const ServerOptions &options)
+{
+    for (int attempt = 0;; attempt++)
+    {
+        try
+        {
+            return std::make_unique<EmbeddedServer>(options);
+        }
+        catch (zmq::error_t &e)
+        {
+            if (e.num() != EADDRINUSE || attempt == 100)
+                throw;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+void test_round_trip()
+{
+    EmbeddedServer server(server_options("inproc://client-test", 2));
+    KeyValueClient client("client-test", "inproc://client-test");
+
+    check(wait(client.put("key", "value")).status == net::NetworkResponse::KEY_ADDED, "put adds a new key");
+    auto response = wait(client.get("key"));
+    check(response.status == net::NetworkResponse::KEY_VALUE && response.value == "value", "get returns the value");
+
+    std::string large(2 * net::value_chunk_size + 1, 'l');
+    check(wait(client.put("large", large)).status == net::NetworkResponse::KEY_ADDED, "put sends a large value in frames");
+    check(wait(client.get("large")).value == large, "get receives a large value whole");
+
+    // The batch is split over both shards and put back together in its own order.
+    std::vector<std::string> keys;
+    net::MultiPutCommand put_batch;
+    for (int i = 0; i < 20; i++)
+        keys.push_back("batch:" + std::to_string(i));
+    for (auto &key : keys)
+        put_batch.items.emplace_back(key, key);
+    response = wait(client.send(put_batch));
+    check(response.statuses == std::vector<net::NetworkResponse>(keys.size(), net::NetworkResponse::KEY_ADDED), "a batch adds every key");
+    response = wait(client.send(net::MultiGetCommand({"batch:3", "missing", "batch:17", "batch:0"})));
+    check(response.statuses.size() == 4 && response.values.size() == 4 && response.values[0] == "batch:3" &&
+              response.statuses[1] == net::NetworkResponse::KEY_DOES_NOT_EXIST && response.values[2] == "batch:17" &&
+              response.values[3] == "batch:0",
+          "a batch returns the values in the order of its keys");
+
+    response = wait(client.send(net::PrefixScanCommand("batch:", 5)));
+    check(response.keys.size() == 5 && response.more && response.keys[0] == "batch:0" && response.keys[1] == "batch:1",
+          "a scan returns the first keys of every shard in order");
+
+    check(wait(client.del("key")).status == net::NetworkResponse::KEY_DELETED, "del removes the key");
+    check(wait(client.get("key")).status == net::NetworkResponse::KEY_DOES_NOT_EXIST, "get misses a removed key");
+}
+
+void test_same_identity()
+{
+    // The identity only names the connection to the server; the internal pipes of both clients stay apart.
+    KeyValueClient first("same-identity", "inproc://same-identity-test", KeyValueClient::default_max_in_flight, 1 << 20);
+    bool created = true;
+    try
+    {
+        KeyValueClient second("same-identity", "inproc://same-identity-test", KeyValueClient::default_max_in_flight, 1 << 20);
+    }
+    catch (zmq::error_t &)
+    {
+        created = false;
+    }
+    check(created, "two clients may share one identity");
+}
+
+void test_near_cache_after_restart()
+{
+    // The system picks a free port; the restarted server binds the same one.
+    auto server = std::make_unique<EmbeddedServer>(server_options("tcp://127.0.0.1:*", 1));
+    const auto endpoint = server->last_endpoint();
+    KeyValueClient client("near-cache-test", endpoint, KeyValueClient::default_max_in_flight, 1 << 20);
+    wait(client.put("cached", "old"));
+    check(wait(client.get("cached")).value == "old", "get returns the value");
+    check(wait(client.get("cached")).value == "old" && client.near_cache_stats().hits == 1, "get answers a cached key locally");
+
+    // The new server has another value and knows nothing of what the client cached.
+    server.reset();
+    server = restart_server(server_options(endpoint, 1));
+    {
+        KeyValueClient writer("near-cache-writer", endpoint);
+        wait(writer.put("cached", "new"));
+    }
+    for (int i = 0; i < 100 && client.near_cache_stats().items > 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    check(client.near_cache_stats().items == 0, "the near cache is dropped when the connection drops");
+    check(wait(client.get("cached")).value == "new", "get reads a cached key again after the server restarted");
+}
+} // namespace
+
+int main()
+{
+    logging::logger().set_level(logging::Level::warning);
+    try
+    {
+        test_round_trip();
+        test_same_identity();
+        test_near_cache_after_restart();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "FAILED: " << e.what() << '\n';
+        return 1;
+    }
+    if (failures > 0)
+        return 1;
+    std::cout << "All tests passed.\n";
+    return 0;
+}
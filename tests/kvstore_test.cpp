@@ -0,0 +1,157 @@
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "key_value_store.hpp"
+
+namespace
+{
+int failures = 0;
+
+void check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED: " << what << '\n';
+        failures++;
+    }
+}
+
+std::string make_key(const std::string &prefix, int i)
+{
+    auto number = std::to_string(i);
+    return prefix + std::string(4 - number.size(), '0') + number;
+}
+
+// All pages of a scan, one after the other, as a client pages through them.
+std::vector<std::pair<std::string, std::string>> scan_all(KeyValueStore &store, const std::string &prefix, std::uint32_t limit,
+                                                          std::uint8_t flags, std::size_t *pages = nullptr)
+{
+    std::vector<std::pair<std::string, std::string>> items;
+    std::string cursor;
+    for (bool first = true;; first = false)
+    {
+        auto page = store.prefix_scan(prefix, limit, flags | (first ? 0 : net::scan_after_cursor), cursor);
+        if (pages)
+            ++*pages;
+        if (page.items.empty())
+            return items;
+        cursor = page.items.back().first;
+        items.insert(items.end(), page.items.begin(), page.items.end());
+        if (!page.more)
+            return items;
+    }
+}
+
+void test_commands()
+{
+    KeyValueStore store;
+    std::string value;
+    check(store.put("key", "value"), "put adds a new key");
+    check(!store.put("key", "other"), "put keeps an existing key");
+    check(store.get("key", value) && value == "value", "get returns the value");
+    check(store.del("key"), "del removes the key");
+    check(!store.get("key", value), "get misses a removed key");
+    check(!store.del("key"), "del misses a removed key");
+}
+
+void test_large_value()
+{
+    KeyValueStore store(2);
+    std::string large(3 * net::value_chunk_size + 123, 'x');
+    for (std::size_t i = 0; i < large.size(); i += 4096)
+        large[i] = static_cast<char>('a' + i % 26);
+    std::string value;
+    check(store.put("large", large), "put takes a large value");
+    check(store.get("large", value) && value == large, "get returns a large value whole");
+    auto page = store.prefix_scan("large", 10, net::scan_with_values);
+    check(page.items.size() == 1 && page.items[0].second == large, "scan returns a large value whole");
+    check(store.del("large") && !store.get("large", value), "del removes a large value");
+}
+
+void test_scan_merge()
+{
+    KeyValueStore store(4);
+    std::set<std::string> keys;
+    for (int i = 0; i < 300; i++)
+    {
+        keys.insert(make_key("a:", i));
+        store.put(make_key("a:", i), "v" + std::to_string(i));
+        store.put(make_key("b:", i), "w");
+    }
+
+    // Every page comes from all four shards.
+    auto items = scan_all(store, "a:", 7, net::scan_with_values);
+    std::vector<std::string> scanned;
+    bool values_match = true;
+    for (auto &[key, value] : items)
+    {
+        scanned.push_back(key);
+        values_match = values_match && value == "v" + std::to_string(std::stoi(key.substr(2)));
+    }
+    check(scanned == std::vector<std::string>(keys.begin(), keys.end()), "paged prefix scan returns every key once, in order");
+    check(values_match, "prefix scan returns the values of the keys");
+
+    auto page = store.scan("a:", "a:0100", 1000);
+    check(page.items.size() == 100 && !page.more && page.items.back().first == "a:0099", "scan stops at the end of the range");
+    check(page.items.front().second.empty(), "scan leaves out the values unless asked for");
+    page = store.scan("", "", 10);
+    check(page.items.size() == 10 && page.more && page.items.front().first == "a:0000", "scan is bounded by its limit");
+}
+
+void test_scan_page_bytes()
+{
+    KeyValueStore store(4);
+    for (int i = 0; i < 24; i++)
+        store.put(make_key("v:", i), std::string(net::value_chunk_size, static_cast<char>('a' + i)));
+
+    std::size_t pages = 0;
+    auto items = scan_all(store, "v:", 1000, net::scan_with_values, &pages);
+    check(items.size() == 24, "a scan bounded by bytes still returns every key");
+    check(pages > 1, "a scan with large values is split into pages");
+    bool in_order = true;
+    for (std::size_t i = 0; i < items.size(); i++)
+        in_order = in_order && items[i].first == make_key("v:", static_cast<int>(i)) && items[i].second[0] == 'a' + static_cast<int>(i);
+    check(in_order, "a scan bounded by bytes returns the keys in order with their values");
+}
+
+void test_eviction_limit()
+{
+    // Keys this small leave the table larger than the entries, which must not make every PUT empty the shard.
+    EvictionOptions eviction;
+    eviction.max_memory = 64 * 1024;
+    KeyValueStore store(2, {}, eviction);
+    for (int i = 0; i < 10000; i++)
+        store.put(make_key("e:", i), "v");
+    auto items = scan_all(store, "e:", 1000, 0);
+    check(items.size() > 1000 && items.size() < 10000, "eviction keeps the entries the limit holds");
+    std::string value;
+    check(store.get(make_key("e:", 9999), value), "eviction keeps the newest entry");
+
+    bool refused = false;
+    try
+    {
+        eviction.max_memory = 2;
+        KeyValueStore tiny(2, {}, eviction);
+    }
+    catch (std::invalid_argument &)
+    {
+        refused = true;
+    }
+    check(refused, "a limit below the empty table is refused");
+}
+} // namespace
+
+int main()
+{
+    test_commands();
+    test_large_value();
+    test_scan_merge();
+    test_scan_page_bytes();
+    test_eviction_limit();
+    if (failures > 0)
+        return 1;
+    std::cout << "All tests passed.\n";
+    return 0;
+}
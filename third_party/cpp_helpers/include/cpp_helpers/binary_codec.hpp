@@ -0,0 +1,123 @@
+#pragma once
+#ifndef BINARY_CODEC_HPP
+#define BINARY_CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+
+namespace codec
+{
+
+// Reads little-endian integers and length-prefixed strings straight out of a buffer it does not own.
+// Strings are returned as views into that buffer, so they are only valid as long as the buffer is.
+// Every read is bounds checked; the first failing read leaves the reader in a failed state.
+class Reader
+{
+private:
+    const std::uint8_t *data_;
+    std::size_t size_;
+    std::size_t pos_;
+    bool ok_;
+
+public:
+    Reader(const void *data, std::size_t size)
+        : data_(static_cast<const std::uint8_t *>(data)), size_(size), pos_(0), ok_(true) {}
+
+    bool ok() const { return ok_; }
+    bool at_end() const { return pos_ == size_; }
+    std::size_t position() const { return pos_; }
+    std::size_t remaining() const { return size_ - pos_; }
+
+    template <typename T>
+    bool read(T &value)
+    {
+        static_assert(std::is_unsigned<T>::value, "only unsigned integers are encoded");
+        if (!ok_ || remaining() < sizeof(T))
+            return ok_ = false;
+        value = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            value |= static_cast<T>(static_cast<T>(data_[pos_ + i]) << (8 * i));
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool read_bytes(std::string_view &str, std::size_t len)
+    {
+        if (!ok_ || remaining() < len)
+            return ok_ = false;
+        str = std::string_view(reinterpret_cast<const char *>(data_ + pos_), len);
+        pos_ += len;
+        return true;
+    }
+
+    // A string prefixed with its length encoded as LengthType.
+    template <typename LengthType = std::uint16_t>
+    bool read_string(std::string_view &str)
+    {
+        LengthType len;
+        return read(len) && read_bytes(str, len);
+    }
+};
+
+// Writes little-endian integers and length-prefixed strings into a preallocated buffer of a known size.
+// Writing past the end, or a string too long for its length prefix, leaves the writer in a failed state.
+class Writer
+{
+private:
+    std::uint8_t *data_;
+    std::size_t size_;
+    std::size_t pos_;
+    bool ok_;
+
+public:
+    Writer(void *data, std::size_t size)
+        : data_(static_cast<std::uint8_t *>(data)), size_(size), pos_(0), ok_(true) {}
+
+    bool ok() const { return ok_; }
+    std::size_t position() const { return pos_; }
+    std::size_t remaining() const { return size_ - pos_; }
+
+    template <typename T>
+    bool write(T value)
+    {
+        static_assert(std::is_unsigned<T>::value, "only unsigned integers are encoded");
+        if (!ok_ || remaining() < sizeof(T))
+            return ok_ = false;
+        for (std::size_t i = 0; i < sizeof(T); i++)
+            data_[pos_ + i] = static_cast<std::uint8_t>(value >> (8 * i));
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool write_bytes(std::string_view str)
+    {
+        if (!ok_ || remaining() < str.size())
+            return ok_ = false;
+        if (!str.empty())
+            std::memcpy(data_ + pos_, str.data(), str.size());
+        pos_ += str.size();
+        return true;
+    }
+
+    template <typename LengthType = std::uint16_t>
+    bool write_string(std::string_view str)
+    {
+        if (str.size() > std::numeric_limits<LengthType>::max())
+            return ok_ = false;
+        return write(static_cast<LengthType>(str.size())) && write_bytes(str);
+    }
+};
+
+template <typename LengthType = std::uint16_t>
+constexpr std::size_t encoded_size(std::string_view str)
+{
+    return sizeof(LengthType) + str.size();
+}
+
+} // namespace codec
+
+#endif // !BINARY_CODEC_HPP
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace stats
+{
+
+// Fixed-size log-linear histogram in the style of HdrHistogram: values below 256 get a bucket each,
+// every power of two above that is split into 128 buckets, so a value is off by less than 1% at any
+// magnitude. Values are plain integers, typically nanoseconds; they saturate at 2^40 (about 18 minutes).
+// Recording is a handful of integer operations and never allocates; histograms of several threads are
+// combined with merge().
+class LatencyHistogram
+{
+private:
+    static constexpr unsigned sub_bucket_bits = 7;
+    static constexpr std::uint64_t sub_bucket_count = 1ull << sub_bucket_bits;
+    static constexpr unsigned max_value_bits = 40;
+    static constexpr std::size_t bucket_count = 2 * sub_bucket_count + (max_value_bits - sub_bucket_bits - 1) * sub_bucket_count;
+
+    std::array<std::uint64_t, bucket_count> counts_;
+    std::uint64_t count_;
+    std::uint64_t sum_;
+    std::uint64_t min_;
+    std::uint64_t max_;
+
+public:
+    static constexpr std::uint64_t max_value = (1ull << max_value_bits) - 1;
+
+    LatencyHistogram() { reset(); }
+
+    void reset()
+    {
+        counts_.fill(0);
+        count_ = 0;
+        sum_ = 0;
+        min_ = std::numeric_limits<std::uint64_t>::max();
+        max_ = 0;
+    }
+
+    void record(std::uint64_t value)
+    {
+        value = std::min(value, max_value);
+        counts_[bucket_of(value)]++;
+        count_++;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (std::size_t i = 0; i < bucket_count; i++)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    std::uint64_t count() const { return count_; }
+    std::uint64_t min() const { return count_ > 0 ? min_ : 0; }
+    std::uint64_t max() const { return max_; }
+    double mean() const { return count_ > 0 ? static_cast<double>(sum_) / count_ : 0.0; }
+
+    // The smallest recorded value that 'percentile' percent of all values are at or below, rounded up to
+    // the end of its bucket.
+    std::uint64_t value_at_percentile(double percentile) const
+    {
+        if (count_ == 0)
+            return 0;
+        auto rank = static_cast<std::uint64_t>(percentile / 100.0 * count_ + 0.5);
+        rank = std::clamp<std::uint64_t>(rank, 1, count_);
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; i++)
+        {
+            seen += counts_[i];
+            if (seen >= rank)
+                return std::min(highest_value_of(i), max_);
+        }
+        return max_;
+    }
+
+private:
+    static unsigned bit_width(std::uint64_t value)
+    {
+        unsigned width = 0;
+        for (; value >= 256; value >>= 8)
+            width += 8;
+        for (; value > 0; value >>= 1)
+            width++;
+        return width;
+    }
+
+    static std::size_t bucket_of(std::uint64_t value)
+    {
+        if (value < 2 * sub_bucket_count)
+            return static_cast<std::size_t>(value);
+        // 'shift' drops all but the top sub_bucket_bits + 1 bits, whose leading bit is always set.
+        auto shift = bit_width(value) - sub_bucket_bits - 1;
+        return static_cast<std::size_t>(2 * sub_bucket_count + (shift - 1) * sub_bucket_count + ((value >> shift) - sub_bucket_count));
+    }
+
+    static std::uint64_t highest_value_of(std::size_t bucket)
+    {
+        if (bucket < 2 * sub_bucket_count)
+            return bucket;
+        auto shift = (bucket - 2 * sub_bucket_count) / sub_bucket_count + 1;
+        auto sub_bucket = (bucket - 2 * sub_bucket_count) % sub_bucket_count + sub_bucket_count;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+};
+
+} // namespace stats
+
+#endif // LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,207 @@
+#pragma once
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "cpp_helpers/singleton.hpp"
+
+namespace logging
+{
+
+enum class Level : std::uint8_t
+{
+    debug,
+    info,
+    warning,
+    error,
+    off
+};
+
+// Asynchronous, leveled logger. A message below the level is dropped before it is even formatted; any other
+// message is formatted by the caller and queued, and a background thread writes the queue in batches, so a
+// slow console never stalls the thread that logs. Warnings and errors go to stderr, the rest to stdout.
+// When the writer falls too far behind, new lines are dropped and counted instead of piling up.
+class Logger : public Singleton<Logger>
+{
+private:
+    friend class Singleton<Logger>;
+
+    struct Line
+    {
+        Level level;
+        std::string text;
+    };
+
+    static constexpr std::size_t max_queued_lines = 100000;
+
+    std::atomic<Level> level_;
+    std::mutex mutex;
+    std::condition_variable queued_cv;
+    std::condition_variable written_cv;
+    std::vector<Line> queue;
+    std::uint64_t dropped;
+    std::uint64_t queued_total;
+    std::uint64_t written_total;
+    bool stopping;
+    std::thread thread;
+
+public:
+    Logger()
+        : level_(Level::info),
+          dropped(0),
+          queued_total(0),
+          written_total(0),
+          stopping(false),
+          thread(&Logger::run, this)
+    {
+    }
+
+    ~Logger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued_cv.notify_one();
+        thread.join();
+    }
+
+    void set_level(Level level) { level_ = level; }
+    Level level() const { return level_; }
+    bool enabled(Level level) const { return level >= level_.load(std::memory_order_relaxed) && level != Level::off; }
+
+    template <typename... Args>
+    void log(Level level, const Args &...args)
+    {
+        if (!enabled(level))
+            return;
+        std::ostringstream text;
+        (text << ... << args);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.size() >= max_queued_lines)
+            {
+                dropped++;
+                return;
+            }
+            queue.push_back({level, text.str()});
+            queued_total++;
+        }
+        queued_cv.notify_one();
+    }
+
+    // Blocks until every line queued so far is written.
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto target = queued_total;
+        queued_cv.notify_one();
+        written_cv.wait(lock, [&] { return written_total >= target || stopping; });
+    }
+
+    static Level parse_level(const std::string &name)
+    {
+        if (name == "debug")
+            return Level::debug;
+        if (name == "info")
+            return Level::info;
+        if (name == "warning")
+            return Level::warning;
+        if (name == "error")
+            return Level::error;
+        if (name == "off")
+            return Level::off;
+        throw std::invalid_argument("unknown log level " + name);
+    }
+
+private:
+    static const char *level_name(Level level)
+    {
+        switch (level)
+        {
+        case Level::debug:
+            return "[debug] ";
+        case Level::info:
+            return "[info] ";
+        case Level::warning:
+            return "[warning] ";
+        default:
+            return "[error] ";
+        }
+    }
+
+    void run()
+    {
+        std::vector<Line> batch;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            queued_cv.wait(lock, [this] { return !queue.empty() || stopping; });
+            if (queue.empty())
+                return;
+
+            batch.swap(queue);
+            auto lost = dropped;
+            dropped = 0;
+            lock.unlock();
+
+            for (auto &line : batch)
+                (line.level >= Level::warning ? std::cerr : std::cout) << level_name(line.level) << line.text << '\n';
+            if (lost > 0)
+                std::cerr << level_name(Level::warning) << lost << " log lines were dropped" << '\n';
+            std::cout.flush();
+            std::cerr.flush();
+
+            lock.lock();
+            written_total += batch.size();
+            batch.clear();
+            written_cv.notify_all();
+        }
+    }
+};
+
+// Singleton::instance() builds a std::function on every call; this is only a guarded static.
+inline Logger &logger()
+{
+    static Logger &instance = Logger::instance();
+    return instance;
+}
+
+template <typename... Args>
+void debug(const Args &...args)
+{
+    logger().log(Level::debug, args...);
+}
+
+template <typename... Args>
+void info(const Args &...args)
+{
+    logger().log(Level::info, args...);
+}
+
+template <typename... Args>
+void warning(const Args &...args)
+{
+    logger().log(Level::warning, args...);
+}
+
+template <typename... Args>
+void error(const Args &...args)
+{
+    logger().log(Level::error, args...);
+}
+
+} // namespace logging
+
+#endif // LOGGER_HPP
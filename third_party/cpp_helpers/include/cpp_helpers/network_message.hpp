@@ -1,10 +1,14 @@
 #ifndef NETWORK_MESSAGE_HPP
 #define NETWORK_MESSAGE_HPP
 
-#include <functional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
-#include "zmq.hpp"
+#include <utility>
+#include <vector>
+#include <zmq.hpp>
+#include "binary_codec.hpp"
 #include "networking.hpp"
 #include "time_utility.hpp"
 
@@ -15,476 +19,759 @@ enum class NetworkCommand : std::uint8_t
 {
     PUT_COMMAND,
     GET_COMMAND,
-    DELETE_COMMAND
+    DELETE_COMMAND,
+    MULTI_PUT_COMMAND,
+    MULTI_GET_COMMAND,
+    MULTI_DELETE_COMMAND,
+    STATS_COMMAND,
+    SCAN_COMMAND,
+    PREFIX_SCAN_COMMAND,
+    TRACKED_GET_COMMAND
 };
 
+constexpr std::size_t command_count = static_cast<std::size_t>(NetworkCommand::TRACKED_GET_COMMAND) + 1;
+
 enum class NetworkResponse : std::uint8_t
 {
     KEY_ADDED,
     KEY_VALUE,
     KEY_DELETED,
     KEY_DOES_NOT_EXIST,
-    KEY_ALREADY_EXIST
-};
-
-class ISerializable
-{
-protected:
-    virtual std::ostream &write(std::ostream &stream) const = 0;
-    virtual std::istream &read(std::istream &stream) = 0;
+    KEY_ALREADY_EXIST,
+    MULTI_STATUS,
+    MULTI_VALUE,
+    STATS,
+    SCAN_RESULT,
+    // The server is a replica and does not take writes.
+    READ_ONLY,
+    // Pushed by the server, not a reply.
+    INVALIDATE
 };
 
-class SendMessage
+// Matches a response to its request; a client must not reuse an id while the request is in flight.
+using RequestId = std::uint32_t;
+
+// Wire format: every message is a header followed by its body, all integers little-endian, keys prefixed
+// with their uint16 length and values with their uint32 length. Decoded strings are views into the received
+// zmq::message_t, so a decoded message must not outlive the message it was decoded from.
+//
+// Large values travel outside the message: a PUT or a KEY_VALUE reply may be followed by value frames, in
+// the same multipart message. Its inline value is then empty and the value is the concatenation of those
+// frames, so it is never copied into, or parsed out of, the first frame.
+using ValueLength = std::uint32_t;
+
+// Values above this size are sent as value frames of at most value_chunk_size bytes each.
+constexpr std::size_t max_inline_value_size = 64 * 1024;
+constexpr std::size_t value_chunk_size = 1024 * 1024;
+// The largest value the store takes: with its key it has to fit in one log record, whose length is 32 bits as well.
+constexpr std::size_t max_value_size = std::numeric_limits<ValueLength>::max() - 2 * 65536;
+
+template <typename DataType>
+struct MessageHeader
 {
-    public:
-    TimeStamp time_stamp;
-    std::uint16_t id;
+    std::uint64_t time_stamp;
+    RequestId id;
     std::uint8_t data_type;
 
-    SendMessage() {}
-    SendMessage(std::uint16_t msg_id, NetworkCommand command)
-        : time_stamp(TimeStamp()),
+    static constexpr std::size_t encoded_size = sizeof(std::uint64_t) + sizeof(RequestId) + sizeof(std::uint8_t);
+
+    MessageHeader() : time_stamp(0), id(0), data_type(0) {}
+    MessageHeader(RequestId msg_id, DataType type)
+        : time_stamp(TimeStamp().value),
           id(msg_id),
-          data_type(static_cast<std::underlying_type<NetworkCommand>::type>(command)) {}
+          data_type(static_cast<std::underlying_type_t<DataType>>(type)) {}
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    void encode(codec::Writer &writer) const
     {
-        if (stream.write((const char *)&time_stamp.value, sizeof(std::uint64_t)))
-            if (stream.write((const char *)&id, sizeof(std::uint16_t)))
-                return stream.write((const char *)&data_type, sizeof(std::uint8_t));
-        return stream;
+        writer.write(time_stamp);
+        writer.write(id);
+        writer.write(data_type);
     }
 
-    std::istream &read(std::istream &stream)
+    bool decode(codec::Reader &reader)
     {
-        if (stream.read((char *)&time_stamp.value, sizeof(std::uint64_t)))
-            if (stream.read((char *)&id, sizeof(std::uint16_t)))
-                return stream.read((char *)&data_type, sizeof(std::uint8_t));
-        return stream;
+        return reader.read(time_stamp) && reader.read(id) && reader.read(data_type);
     }
+};
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const SendMessage& e) {
-        return e.write(stream);
-    }
+using SendMessage = MessageHeader<NetworkCommand>;
+using ResponseMessage = MessageHeader<NetworkResponse>;
 
-    friend std::istream &operator>>(std::istream &stream, SendMessage& e) {
-        return e.read(stream);
-    }
+struct KeyData
+{
+    std::string_view key;
+
+    KeyData() {}
+    KeyData(std::string_view key) : key(key) {}
+
+    std::size_t encoded_size() const { return codec::encoded_size(key); }
+    void encode(codec::Writer &writer) const { writer.write_string(key); }
+    bool decode(codec::Reader &reader) { return reader.read_string(key); }
 };
 
-class ResponseMessage
+struct KeyValueData
 {
-    public:
-    TimeStamp time_stamp;
-    std::uint16_t id;
-    std::uint8_t data_type;
+    std::string_view key;
+    std::string_view value;
 
-    ResponseMessage() {}
-    ResponseMessage(std::uint16_t msg_id, NetworkResponse response)
-        : time_stamp(TimeStamp()),
-          id(msg_id),
-          data_type(static_cast<std::underlying_type<NetworkResponse>::type>(response)) {}
+    KeyValueData() {}
+    KeyValueData(std::string_view key, std::string_view value) : key(key), value(value) {}
+
+    std::size_t encoded_size() const { return codec::encoded_size(key) + codec::encoded_size<ValueLength>(value); }
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    void encode(codec::Writer &writer) const
     {
-        if (stream.write((const char *)&time_stamp.value, sizeof(std::uint64_t)))
-            if (stream.write((const char *)&id, sizeof(std::uint16_t)))
-                return stream.write((const char *)&data_type, sizeof(std::uint8_t));
-        return stream;
+        writer.write_string(key);
+        writer.write_string<ValueLength>(value);
     }
 
-    std::istream &read(std::istream &stream)
+    bool decode(codec::Reader &reader)
     {
-        if (stream.read((char *)&time_stamp.value, sizeof(std::uint64_t)))
-            if (stream.read((char *)&id, sizeof(std::uint16_t)))
-                return stream.read((char *)&data_type, sizeof(std::uint8_t));
-        return stream;
+        return reader.read_string(key) && reader.read_string<ValueLength>(value);
     }
+};
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const ResponseMessage &e) {
-        return e.write(stream);
-    }
+struct PutCommand : public KeyValueData
+{
+    using KeyValueData::KeyValueData;
+    static constexpr NetworkCommand type() { return NetworkCommand::PUT_COMMAND; }
+};
 
-    friend std::istream &operator>>(std::istream &stream, ResponseMessage &e) {
-        return e.read(stream);
-    }
+struct GetCommand : public KeyData
+{
+    using KeyData::KeyData;
+    static constexpr NetworkCommand type() { return NetworkCommand::GET_COMMAND; }
 };
 
-struct BaseCommandData
+struct DeleteCommand : public KeyData
 {
-protected:
-    NetworkCommand type_;
+    using KeyData::KeyData;
+    static constexpr NetworkCommand type() { return NetworkCommand::DELETE_COMMAND; }
+};
+
+// A GET after which the server tells the client, with an INVALIDATE push, once the value it read changes.
+// The server only remembers keys that were found.
+struct TrackedGetCommand : public KeyData
+{
+    using KeyData::KeyData;
+    static constexpr NetworkCommand type() { return NetworkCommand::TRACKED_GET_COMMAND; }
+};
 
-public:
-    BaseCommandData(NetworkCommand type) : type_(type) {}
-    virtual ~BaseCommandData() {}
-    NetworkCommand type() const { return type_; }
+struct KeyAddedResponseData : public KeyData
+{
+    using KeyData::KeyData;
+    static constexpr NetworkResponse type() { return NetworkResponse::KEY_ADDED; }
 };
 
-struct BaseResponseData
+struct KeyValueResponseData : public KeyValueData
 {
-protected:
-    NetworkResponse type_;
+    using KeyValueData::KeyValueData;
+    static constexpr NetworkResponse type() { return NetworkResponse::KEY_VALUE; }
+};
 
-public:
-    BaseResponseData(NetworkResponse type) : type_(type) {}
-    virtual ~BaseResponseData() {}
-    NetworkResponse type() const { return type_; }
+struct KeyDeletedResponseData : public KeyData
+{
+    using KeyData::KeyData;
+    static constexpr NetworkResponse type() { return NetworkResponse::KEY_DELETED; }
 };
 
-struct PutCommand : public BaseCommandData, public ISerializable
+struct KeyNotExistResponseData : public KeyData
 {
-    std::string key;
-    std::string value;
+    using KeyData::KeyData;
+    static constexpr NetworkResponse type() { return NetworkResponse::KEY_DOES_NOT_EXIST; }
+};
 
-    PutCommand() : BaseCommandData(NetworkCommand::PUT_COMMAND) {}
-    PutCommand(const std::string &key, const std::string &value) : BaseCommandData(NetworkCommand::PUT_COMMAND), key(key), value(value) {}
+struct KeyAlreadyExistResponseData : public KeyData
+{
+    using KeyData::KeyData;
+    static constexpr NetworkResponse type() { return NetworkResponse::KEY_ALREADY_EXIST; }
+};
 
-protected:
-    std::ostream &write(std::ostream &stream) const
-    {
-        std::uint16_t len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-            if (stream.write((const char *)&key[0], len))
-            {
-                len = (std::uint16_t)value.size();
-                if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-                    return stream.write((const char *)&value[0], len);
-            }
-        return stream;
-    }
+// Batches are encoded as a uint32 entry count followed by the entries. Decoding checks the count against
+// the bytes left before reserving anything, so a corrupt count cannot trigger a huge allocation.
+inline bool read_count(codec::Reader &reader, std::uint32_t &count, std::size_t min_entry_size)
+{
+    return reader.read(count) && count <= reader.remaining() / min_entry_size;
+}
+
+struct MultiKeyData
+{
+    std::vector<std::string_view> keys;
+
+    MultiKeyData() {}
+    MultiKeyData(std::vector<std::string_view> keys) : keys(std::move(keys)) {}
 
-    std::istream &read(std::istream &stream)
+    std::size_t encoded_size() const
     {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
-        {
-            key.resize(len);
-            if (stream.read((char *)&key[0], len))
-            {
-                if (stream.read((char *)&len, sizeof(std::uint16_t)))
-                {
-                    value.resize(len);
-                    return stream.read((char *)&value[0], len);
-                }
-            }
-        }
-        return stream;
+        std::size_t size = sizeof(std::uint32_t);
+        for (auto &key : keys)
+            size += codec::encoded_size(key);
+        return size;
     }
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const PutCommand &e)
+    void encode(codec::Writer &writer) const
     {
-        return e.write(stream);
+        writer.write(static_cast<std::uint32_t>(keys.size()));
+        for (auto &key : keys)
+            writer.write_string(key);
     }
 
-    friend std::istream &operator>>(std::istream &stream, PutCommand &e)
+    bool decode(codec::Reader &reader)
     {
-        return e.read(stream);
+        std::uint32_t count;
+        if (!read_count(reader, count, sizeof(std::uint16_t)))
+            return false;
+        keys.resize(count);
+        for (auto &key : keys)
+        {
+            if (!reader.read_string(key))
+                return false;
+        }
+        return true;
     }
 };
 
-struct GetCommand : public BaseCommandData, public ISerializable
+struct MultiKeyValueData
 {
-    std::string key;
+    std::vector<std::pair<std::string_view, std::string_view>> items;
 
-    GetCommand() : BaseCommandData(NetworkCommand::GET_COMMAND) {}
-    GetCommand(const std::string &key) : BaseCommandData(NetworkCommand::GET_COMMAND), key(key) {}
+    MultiKeyValueData() {}
+    MultiKeyValueData(std::vector<std::pair<std::string_view, std::string_view>> items) : items(std::move(items)) {}
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    std::size_t encoded_size() const
     {
-        std::uint16_t key_len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&key_len, sizeof(std::uint16_t)))
-            return (stream.write((const char *)&key[0], key_len));
-        return stream;
+        std::size_t size = sizeof(std::uint32_t);
+        for (auto &[key, value] : items)
+            size += codec::encoded_size(key) + codec::encoded_size<ValueLength>(value);
+        return size;
     }
 
-    std::istream &read(std::istream &stream)
+    void encode(codec::Writer &writer) const
     {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
+        writer.write(static_cast<std::uint32_t>(items.size()));
+        for (auto &[key, value] : items)
         {
-            key.resize(len);
-            return stream.read((char *)&key[0], len);
+            writer.write_string(key);
+            writer.write_string<ValueLength>(value);
         }
-        return stream;
     }
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const GetCommand &e)
+    bool decode(codec::Reader &reader)
     {
-        return e.write(stream);
+        std::uint32_t count;
+        if (!read_count(reader, count, sizeof(std::uint16_t) + sizeof(ValueLength)))
+            return false;
+        items.resize(count);
+        for (auto &[key, value] : items)
+        {
+            if (!reader.read_string(key) || !reader.read_string<ValueLength>(value))
+                return false;
+        }
+        return true;
     }
+};
 
-    friend std::istream &operator>>(std::istream &stream, GetCommand &e)
-    {
-        return e.read(stream);
-    }
+struct MultiPutCommand : public MultiKeyValueData
+{
+    using MultiKeyValueData::MultiKeyValueData;
+    static constexpr NetworkCommand type() { return NetworkCommand::MULTI_PUT_COMMAND; }
+};
+
+struct MultiGetCommand : public MultiKeyData
+{
+    using MultiKeyData::MultiKeyData;
+    static constexpr NetworkCommand type() { return NetworkCommand::MULTI_GET_COMMAND; }
 };
 
-struct DeleteCommand : public BaseCommandData, public ISerializable
+struct MultiDeleteCommand : public MultiKeyData
 {
-    std::string key;
+    using MultiKeyData::MultiKeyData;
+    static constexpr NetworkCommand type() { return NetworkCommand::MULTI_DELETE_COMMAND; }
+};
 
-    DeleteCommand() : BaseCommandData(NetworkCommand::DELETE_COMMAND) {}
-    DeleteCommand(const std::string &key) : BaseCommandData(NetworkCommand::DELETE_COMMAND), key(key) {}
+// Reply to MULTI_PUT and MULTI_DELETE: one status per key, in request order. The statuses are the
+// single-key responses (KEY_ADDED, KEY_ALREADY_EXIST, KEY_DELETED, KEY_DOES_NOT_EXIST).
+struct MultiStatusResponseData
+{
+    std::vector<NetworkResponse> statuses;
 
-protected:
-    std::ostream &write(std::ostream &stream) const
-    {
-        std::uint16_t len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-            return (stream.write((const char *)&key[0], len));
-        return stream;
-    }
+    MultiStatusResponseData() {}
+    MultiStatusResponseData(std::vector<NetworkResponse> statuses) : statuses(std::move(statuses)) {}
+    static constexpr NetworkResponse type() { return NetworkResponse::MULTI_STATUS; }
 
-    std::istream &read(std::istream &stream)
-    {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
-        {
-            key.resize(len);
-            return stream.read((char *)&key[0], len);
-        }
-        return stream;
-    }
+    std::size_t encoded_size() const { return sizeof(std::uint32_t) + statuses.size() * sizeof(std::uint8_t); }
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const DeleteCommand &e)
+    void encode(codec::Writer &writer) const
     {
-        return e.write(stream);
+        writer.write(static_cast<std::uint32_t>(statuses.size()));
+        for (auto status : statuses)
+            writer.write(static_cast<std::uint8_t>(status));
     }
 
-    friend std::istream &operator>>(std::istream &stream, DeleteCommand &e)
+    bool decode(codec::Reader &reader)
     {
-        return e.read(stream);
+        std::uint32_t count;
+        if (!read_count(reader, count, sizeof(std::uint8_t)))
+            return false;
+        statuses.resize(count);
+        for (auto &status : statuses)
+        {
+            std::uint8_t value;
+            if (!reader.read(value))
+                return false;
+            status = static_cast<NetworkResponse>(value);
+        }
+        return true;
     }
 };
 
-struct KeyAddedResponseData : public BaseResponseData, public ISerializable
+// Reply to MULTI_GET: one entry per key, in request order. The status is KEY_VALUE, followed by the
+// value, or KEY_DOES_NOT_EXIST without a value.
+struct MultiValueResponseData
 {
-    std::string key;
-    std::string value;
+    struct Entry
+    {
+        NetworkResponse status;
+        std::string_view value;
+    };
+    std::vector<Entry> entries;
 
-    KeyAddedResponseData() : BaseResponseData(NetworkResponse::KEY_ADDED) {}
-    KeyAddedResponseData(const std::string &key, const std::string &value) : BaseResponseData(NetworkResponse::KEY_ADDED), key(key), value(value) {}
+    MultiValueResponseData() {}
+    MultiValueResponseData(std::vector<Entry> entries) : entries(std::move(entries)) {}
+    static constexpr NetworkResponse type() { return NetworkResponse::MULTI_VALUE; }
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    std::size_t encoded_size() const
     {
-         std::uint16_t len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-            if (stream.write((const char *)&key[0], len))
-            {
-                len = (std::uint16_t)value.size();
-                if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-                    return stream.write((const char *)&value[0], len);
-            }
-        return stream;
+        std::size_t size = sizeof(std::uint32_t);
+        for (auto &entry : entries)
+            size += sizeof(std::uint8_t) + (entry.status == NetworkResponse::KEY_VALUE ? codec::encoded_size<ValueLength>(entry.value) : 0);
+        return size;
     }
 
-    std::istream &read(std::istream &stream)
+    void encode(codec::Writer &writer) const
     {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
+        writer.write(static_cast<std::uint32_t>(entries.size()));
+        for (auto &entry : entries)
         {
-            key.resize(len);
-            if (stream.read((char *)&key[0], len))
-            {
-                if (stream.read((char *)&len, sizeof(std::uint16_t)))
-                {
-                    value.resize(len);
-                    return stream.read((char *)&value[0], len);
-                }
-            }
+            writer.write(static_cast<std::uint8_t>(entry.status));
+            if (entry.status == NetworkResponse::KEY_VALUE)
+                writer.write_string<ValueLength>(entry.value);
         }
-        return stream;
-    }
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const KeyAddedResponseData &e)
-    {
-        return e.write(stream);
     }
 
-    friend std::istream &operator>>(std::istream &stream, KeyAddedResponseData &e)
+    bool decode(codec::Reader &reader)
     {
-        return e.read(stream);
+        std::uint32_t count;
+        if (!read_count(reader, count, sizeof(std::uint8_t)))
+            return false;
+        entries.resize(count);
+        for (auto &entry : entries)
+        {
+            std::uint8_t status;
+            if (!reader.read(status))
+                return false;
+            entry.status = static_cast<NetworkResponse>(status);
+            entry.value = std::string_view();
+            if (entry.status == NetworkResponse::KEY_VALUE && !reader.read_string<ValueLength>(entry.value))
+                return false;
+        }
+        return true;
     }
 };
 
-struct KeyValueResponseData : public BaseResponseData, public ISerializable
+// Asks the server for its counters and latency histograms.
+struct StatsCommand
 {
-    std::string key;
-    std::string value;
+    static constexpr NetworkCommand type() { return NetworkCommand::STATS_COMMAND; }
 
-    KeyValueResponseData() : BaseResponseData(NetworkResponse::KEY_VALUE) {}
-    KeyValueResponseData(const std::string &key, const std::string &value) : BaseResponseData(NetworkResponse::KEY_VALUE), key(key), value(value) {}
+    std::size_t encoded_size() const { return 0; }
+    void encode(codec::Writer &) const {}
+    bool decode(codec::Reader &) { return true; }
+};
+
+// Reply to STATS: one metric per line in the Prometheus text format, e.g.
+// kv_requests_total{shard="0",command="get"} 42
+struct StatsResponseData
+{
+    std::string_view text;
+
+    StatsResponseData() {}
+    StatsResponseData(std::string_view text) : text(text) {}
+    static constexpr NetworkResponse type() { return NetworkResponse::STATS; }
+
+    std::size_t encoded_size() const { return codec::encoded_size<std::uint32_t>(text); }
+    void encode(codec::Writer &writer) const { writer.write_string<std::uint32_t>(text); }
+    bool decode(codec::Reader &reader) { return reader.read_string<std::uint32_t>(text); }
+};
+
+// Scans page through the keys in order. A page holds at most 'limit' keys (0 asks for the server's default,
+// and the server caps it at max_scan_limit); the next page starts after the last key of this one, passed
+// back as 'cursor' with scan_after_cursor set. A page also ends early once its keys and values would exceed
+// max_scan_page_bytes, though it always holds at least one key.
+constexpr std::uint8_t scan_with_values = 1;
+constexpr std::uint8_t scan_after_cursor = 2;
+constexpr std::uint32_t max_scan_limit = 1000;
+constexpr std::size_t max_scan_page_bytes = 4 * 1024 * 1024;
+
+// SCAN: the keys in [start, end); an empty 'end' means no upper bound.
+struct ScanCommand
+{
+    std::string_view start;
+    std::string_view end;
+    std::string_view cursor;
+    std::uint32_t limit = 0;
+    std::uint8_t flags = 0;
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    ScanCommand() {}
+    ScanCommand(std::string_view start, std::string_view end, std::uint32_t limit = 0, std::uint8_t flags = 0, std::string_view cursor = {})
+        : start(start), end(end), cursor(cursor), limit(limit), flags(flags) {}
+    static constexpr NetworkCommand type() { return NetworkCommand::SCAN_COMMAND; }
+
+    std::size_t encoded_size() const
     {
-         std::uint16_t len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-            if (stream.write((const char *)&key[0], len))
-            {
-                len = (std::uint16_t)value.size();
-                if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-                    return stream.write((const char *)&value[0], len);
-            }
-        return stream;
+        return codec::encoded_size(start) + codec::encoded_size(end) + codec::encoded_size(cursor) + sizeof(limit) + sizeof(flags);
     }
 
-    std::istream &read(std::istream &stream)
+    void encode(codec::Writer &writer) const
     {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
-        {
-            key.resize(len);
-            if (stream.read((char *)&key[0], len))
-            {
-                if (stream.read((char *)&len, sizeof(std::uint16_t)))
-                {
-                    value.resize(len);
-                    return stream.read((char *)&value[0], len);
-                }
-            }
-        }
-        return stream;
+        writer.write_string(start);
+        writer.write_string(end);
+        writer.write_string(cursor);
+        writer.write(limit);
+        writer.write(flags);
+    }
+
+    bool decode(codec::Reader &reader)
+    {
+        return reader.read_string(start) && reader.read_string(end) && reader.read_string(cursor) &&
+               reader.read(limit) && reader.read(flags);
     }
+};
+
+// PREFIX_SCAN: the keys that start with 'prefix'.
+struct PrefixScanCommand
+{
+    std::string_view prefix;
+    std::string_view cursor;
+    std::uint32_t limit = 0;
+    std::uint8_t flags = 0;
+
+    PrefixScanCommand() {}
+    PrefixScanCommand(std::string_view prefix, std::uint32_t limit = 0, std::uint8_t flags = 0, std::string_view cursor = {})
+        : prefix(prefix), cursor(cursor), limit(limit), flags(flags) {}
+    static constexpr NetworkCommand type() { return NetworkCommand::PREFIX_SCAN_COMMAND; }
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const KeyValueResponseData &e)
+    std::size_t encoded_size() const { return codec::encoded_size(prefix) + codec::encoded_size(cursor) + sizeof(limit) + sizeof(flags); }
+
+    void encode(codec::Writer &writer) const
     {
-        return e.write(stream);
+        writer.write_string(prefix);
+        writer.write_string(cursor);
+        writer.write(limit);
+        writer.write(flags);
     }
 
-    friend std::istream &operator>>(std::istream &stream, KeyValueResponseData &e)
+    bool decode(codec::Reader &reader)
     {
-        return e.read(stream);
+        return reader.read_string(prefix) && reader.read_string(cursor) && reader.read(limit) && reader.read(flags);
     }
 };
 
-struct KeyDeletedResponseData : public BaseResponseData, public ISerializable
+// Reply to SCAN and PREFIX_SCAN: one page of keys in order, with their values if they were asked for.
+// 'more' is set when keys are left after the page; 'limit' is the page size the server applied.
+struct ScanResponseData
 {
-    std::string key;
+    std::uint32_t limit = 0;
+    bool more = false;
+    bool with_values = false;
+    std::vector<std::pair<std::string_view, std::string_view>> items;
 
-    KeyDeletedResponseData() : BaseResponseData(NetworkResponse::KEY_DELETED) {}
-    KeyDeletedResponseData(const std::string &key) : BaseResponseData(NetworkResponse::KEY_DELETED), key(key) {}
+    ScanResponseData() {}
+    static constexpr NetworkResponse type() { return NetworkResponse::SCAN_RESULT; }
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    std::size_t encoded_size() const
     {
-        std::uint16_t len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-            return (stream.write((const char *)&key[0], len));
-        return stream;
+        std::size_t size = sizeof(limit) + 2 * sizeof(std::uint8_t) + sizeof(std::uint32_t);
+        for (auto &[key, value] : items)
+            size += codec::encoded_size(key) + (with_values ? codec::encoded_size<ValueLength>(value) : 0);
+        return size;
     }
 
-    std::istream &read(std::istream &stream)
+    void encode(codec::Writer &writer) const
     {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
+        writer.write(limit);
+        writer.write(static_cast<std::uint8_t>(more));
+        writer.write(static_cast<std::uint8_t>(with_values));
+        writer.write(static_cast<std::uint32_t>(items.size()));
+        for (auto &[key, value] : items)
         {
-            key.resize(len);
-            return stream.read((char *)&key[0], len);
+            writer.write_string(key);
+            if (with_values)
+                writer.write_string<ValueLength>(value);
         }
-        return stream;
     }
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const KeyDeletedResponseData &e)
+    bool decode(codec::Reader &reader)
     {
-        return e.write(stream);
+        std::uint8_t more_value, with_values_value;
+        std::uint32_t count;
+        if (!reader.read(limit) || !reader.read(more_value) || !reader.read(with_values_value) ||
+            !read_count(reader, count, sizeof(std::uint16_t)))
+            return false;
+        more = more_value != 0;
+        with_values = with_values_value != 0;
+        items.resize(count);
+        for (auto &[key, value] : items)
+        {
+            value = std::string_view();
+            if (!reader.read_string(key) || (with_values && !reader.read_string<ValueLength>(value)))
+                return false;
+        }
+        return true;
     }
+};
 
-    friend std::istream &operator>>(std::istream &stream, KeyDeletedResponseData &e)
-    {
-        return e.read(stream);
-    }
+// Pushed to a client, with request id 0, when keys it read with TRACKED_GET were deleted, evicted or
+// replaced. The keys are no longer tracked for it afterwards.
+struct InvalidateData : public MultiKeyData
+{
+    using MultiKeyData::MultiKeyData;
+    static constexpr NetworkResponse type() { return NetworkResponse::INVALIDATE; }
+};
+
+// Reply of a replica to PUT, DELETE and their batches.
+struct ReadOnlyResponseData
+{
+    static constexpr NetworkResponse type() { return NetworkResponse::READ_ONLY; }
+
+    std::size_t encoded_size() const { return 0; }
+    void encode(codec::Writer &) const {}
+    bool decode(codec::Reader &) { return true; }
+};
+
+// Replication: a primary publishes the mutations of every shard as a stream of batches. The mutations of a
+// shard are numbered without gaps; a batch holds 'count' of them, numbered from 'sequence' on. A shard
+// without mutations sends an empty batch now and then, carrying the next number, so replicas can tell a
+// quiet primary from a lost one. 'epoch' changes whenever the primary restarts, and with it the numbering.
+enum class MutationType : std::uint8_t
+{
+    PUT_MUTATION,
+    DELETE_MUTATION
 };
 
-struct KeyNotExistResponseData : public BaseResponseData, public ISerializable
+// The batch holds entries of a snapshot, which are not numbered.
+constexpr std::uint8_t replication_snapshot = 1;
+// The store is emptied before the batch is applied.
+constexpr std::uint8_t replication_reset = 2;
+
+struct ReplicationHeader
 {
-    std::string key;
+    std::uint64_t epoch = 0;
+    std::uint16_t shard = 0;
+    std::uint16_t shard_count = 1;
+    std::uint64_t sequence = 0;
+    // Wall clock of the primary when the batch was sent, in nanoseconds since 1970.
+    std::uint64_t time = 0;
+    std::uint8_t flags = 0;
+    std::uint32_t count = 0;
 
-    KeyNotExistResponseData() : BaseResponseData(NetworkResponse::KEY_DOES_NOT_EXIST) {}
-    KeyNotExistResponseData(const std::string &key) : BaseResponseData(NetworkResponse::KEY_DOES_NOT_EXIST), key(key) {}
+    static constexpr std::size_t encoded_size = 4 * sizeof(std::uint64_t) + 2 * sizeof(std::uint16_t) + sizeof(std::uint8_t) + sizeof(std::uint32_t);
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    void encode(codec::Writer &writer) const
     {
-        std::uint16_t len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-            return (stream.write((const char *)&key[0], len));
-        return stream;
+        writer.write(epoch);
+        writer.write(shard);
+        writer.write(shard_count);
+        writer.write(sequence);
+        writer.write(time);
+        writer.write(flags);
+        writer.write(count);
     }
 
-    std::istream &read(std::istream &stream)
+    bool decode(codec::Reader &reader)
     {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
-        {
-            key.resize(len);
-            return stream.read((char *)&key[0], len);
-        }
-        return stream;
+        return reader.read(epoch) && reader.read(shard) && reader.read(shard_count) && reader.read(sequence) &&
+               reader.read(time) && reader.read(flags) && reader.read(count);
+    }
+};
+
+// A PUT carries the value, a DELETE only the key.
+struct Mutation
+{
+    MutationType type = MutationType::PUT_MUTATION;
+    std::string_view key;
+    std::string_view value;
+
+    std::size_t encoded_size() const
+    {
+        return sizeof(std::uint8_t) + codec::encoded_size(key) + (type == MutationType::PUT_MUTATION ? codec::encoded_size<ValueLength>(value) : 0);
     }
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const KeyNotExistResponseData &e)
+    void encode(codec::Writer &writer) const
     {
-        return e.write(stream);
+        writer.write(static_cast<std::uint8_t>(type));
+        writer.write_string(key);
+        if (type == MutationType::PUT_MUTATION)
+            writer.write_string<ValueLength>(value);
     }
 
-    friend std::istream &operator>>(std::istream &stream, KeyNotExistResponseData &e)
+    bool decode(codec::Reader &reader)
     {
-        return e.read(stream);
+        std::uint8_t type_value;
+        if (!reader.read(type_value) || type_value > static_cast<std::uint8_t>(MutationType::DELETE_MUTATION) || !reader.read_string(key))
+            return false;
+        type = static_cast<MutationType>(type_value);
+        value = std::string_view();
+        return type != MutationType::PUT_MUTATION || reader.read_string<ValueLength>(value);
     }
 };
 
-struct KeyAlreadyExistResponseData : public BaseResponseData, public ISerializable
+struct ReplicationBatch
 {
-    std::string key;
+    ReplicationHeader header;
+    std::vector<Mutation> mutations;
 
-    KeyAlreadyExistResponseData() : BaseResponseData(NetworkResponse::KEY_ALREADY_EXIST) {}
-    KeyAlreadyExistResponseData(const std::string &key) : BaseResponseData(NetworkResponse::KEY_ALREADY_EXIST), key(key) {}
+    std::size_t encoded_size() const
+    {
+        std::size_t size = ReplicationHeader::encoded_size;
+        for (auto &mutation : mutations)
+            size += mutation.encoded_size();
+        return size;
+    }
 
-protected:
-    std::ostream &write(std::ostream &stream) const
+    void encode(codec::Writer &writer) const
     {
-        std::uint16_t len = (std::uint16_t)key.size();
-        if (stream.write((const char *)&len, sizeof(std::uint16_t)))
-            return (stream.write((const char *)&key[0], len));
-        return stream;
+        header.encode(writer);
+        for (auto &mutation : mutations)
+            mutation.encode(writer);
     }
 
-    std::istream &read(std::istream &stream)
+    bool decode(codec::Reader &reader)
     {
-        std::uint16_t len;
-        if (stream.read((char *)&len, sizeof(std::uint16_t)))
+        if (!header.decode(reader) || header.count > reader.remaining() / (sizeof(std::uint8_t) + sizeof(std::uint16_t)))
+            return false;
+        mutations.resize(header.count);
+        for (auto &mutation : mutations)
         {
-            key.resize(len);
-            return stream.read((char *)&key[0], len);
+            if (!mutation.decode(reader))
+                return false;
         }
-        return stream;
+        return true;
     }
+};
 
-public:
-    friend std::ostream &operator<<(std::ostream &stream, const KeyAlreadyExistResponseData &e)
+// Encodes header and body into a single, exactly sized message.
+template <typename Header, typename Data>
+zmq::message_t encode_message(const Header &header, const Data &data)
+{
+    zmq::message_t msg(Header::encoded_size + data.encoded_size());
+    codec::Writer writer(msg.data(), msg.size());
+    header.encode(writer);
+    data.encode(writer);
+    if (!writer.ok())
+        throw std::length_error("message field exceeds the wire format limits");
+    return msg;
+}
+
+// Copies 'value' into value frames of at most value_chunk_size bytes each.
+inline Frames make_value_frames(std::string_view value)
+{
+    Frames frames;
+    frames.reserve((value.size() + value_chunk_size - 1) / value_chunk_size);
+    for (std::size_t offset = 0; offset < value.size(); offset += value_chunk_size)
     {
-        return e.write(stream);
+        auto chunk = value.substr(offset, value_chunk_size);
+        frames.emplace_back(chunk.data(), chunk.size());
     }
+    return frames;
+}
 
-    friend std::istream &operator>>(std::istream &stream, KeyAlreadyExistResponseData &e)
-    {
-        return e.read(stream);
-    }
-};
+template <typename Data>
+zmq::message_t encode_command(RequestId id, const Data &data)
+{
+    return encode_message(SendMessage(id, Data::type()), data);
+}
+
+template <typename Data>
+zmq::message_t encode_response(RequestId id, const Data &data)
+{
+    return encode_message(ResponseMessage(id, Data::type()), data);
+}
+
+inline bool is_multi_key_command(NetworkCommand command)
+{
+    return command == NetworkCommand::MULTI_PUT_COMMAND ||
+           command == NetworkCommand::MULTI_GET_COMMAND ||
+           command == NetworkCommand::MULTI_DELETE_COMMAND;
+}
+
+// Commands a replica refuses.
+inline bool is_write_command(NetworkCommand command)
+{
+    return command == NetworkCommand::PUT_COMMAND || command == NetworkCommand::DELETE_COMMAND ||
+           command == NetworkCommand::MULTI_PUT_COMMAND || command == NetworkCommand::MULTI_DELETE_COMMAND;
+}
+
+inline bool is_scan_command(NetworkCommand command)
+{
+    return command == NetworkCommand::SCAN_COMMAND || command == NetworkCommand::PREFIX_SCAN_COMMAND;
+}
+
+// Commands that more than one shard may have to answer: the batches, which are split by key, the scans and STATS.
+inline bool is_broadcast_command(NetworkCommand command)
+{
+    return is_multi_key_command(command) || is_scan_command(command) || command == NetworkCommand::STATS_COMMAND;
+}
+
+inline const char *command_name(NetworkCommand command)
+{
+    switch (command)
+    {
+    case NetworkCommand::PUT_COMMAND:
+        return "put";
+    case NetworkCommand::GET_COMMAND:
+        return "get";
+    case NetworkCommand::DELETE_COMMAND:
+        return "delete";
+    case NetworkCommand::MULTI_PUT_COMMAND:
+        return "multi_put";
+    case NetworkCommand::MULTI_GET_COMMAND:
+        return "multi_get";
+    case NetworkCommand::MULTI_DELETE_COMMAND:
+        return "multi_delete";
+    case NetworkCommand::STATS_COMMAND:
+        return "stats";
+    case NetworkCommand::SCAN_COMMAND:
+        return "scan";
+    case NetworkCommand::PREFIX_SCAN_COMMAND:
+        return "prefix_scan";
+    case NetworkCommand::TRACKED_GET_COMMAND:
+        return "tracked_get";
+    default:
+        return "unknown";
+    }
+}
+
+// Every single-key command starts with its key, so the key can be looked at (e.g. to route the
+// request) without decoding the rest of the message.
+inline bool peek_command_key(const void *data, std::size_t size, std::string_view &key)
+{
+    codec::Reader reader(data, size);
+    SendMessage header;
+    return header.decode(reader) &&
+           !is_broadcast_command(static_cast<NetworkCommand>(header.data_type)) &&
+           reader.read_string(key);
+}
+
+inline bool peek_command_type(const void *data, std::size_t size, NetworkCommand &command)
+{
+    codec::Reader reader(data, size);
+    SendMessage header;
+    if (!header.decode(reader))
+        return false;
+    command = static_cast<NetworkCommand>(header.data_type);
+    return true;
+}
 
 } // namespace net
 
@@ -3,12 +3,15 @@
 #define TARJA_NETWORKING_HPP
 
 #include <array>
+#include <cerrno>
 #include <thread>
 #include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <mutex>
+#include <stdexcept>
+#include <vector>
 #include "cpp_helpers/string_utility.hpp"
 #include "cpp_helpers/singleton.hpp"
 #include <zmq.hpp>
@@ -16,6 +19,8 @@
 namespace net
 {
 using Port = std::uint16_t;
+// The frames that follow the first frame of a multipart message.
+using Frames = std::vector<zmq::message_t>;
 
 enum TransportProtocol : std::uint8_t
 {
@@ -134,34 +139,83 @@ public:
     }
 };
 
+// The ZeroMQ endpoint of 'host' and 'port' ('*' for every interface when binding). Any other transport
+// ZeroMQ knows, e.g. ipc:///tmp/kv.sock or inproc://kv, is given as an endpoint string instead.
+inline std::string endpoint(TransportProtocol protocol, const std::string &host, Port port)
+{
+    // ROUTER and DEALER sockets only run over connection-oriented transports.
+    if (protocol != TCP)
+        throw std::invalid_argument("only tcp is supported for host and port endpoints");
+    return "tcp://" + host + ":" + std::to_string(port);
+}
+
+// Receives the rest of the multipart message whose last received frame is 'frame'.
+inline void receive_more(zmq::socket_t &socket, const zmq::message_t &frame, Frames &frames)
+{
+    for (auto *last = &frame; last->more(); last = &frames.back())
+    {
+        frames.emplace_back();
+        socket.recv(&frames.back());
+    }
+}
+
+// Sends 'frames' as the rest of a multipart message whose first frame was sent with ZMQ_SNDMORE.
+inline void send_more(zmq::socket_t &socket, Frames &frames, int flags = 0)
+{
+    for (std::size_t i = 0; i < frames.size(); i++)
+        socket.send(frames[i], i + 1 < frames.size() ? flags | ZMQ_SNDMORE : flags);
+}
+
+// zmq::poll that reports a signal interruption as "nothing ready" instead of throwing.
+inline bool poll(zmq::pollitem_t *items, std::size_t count, long timeout_ms)
+{
+    try
+    {
+        return zmq::poll(items, count, timeout_ms) > 0;
+    }
+    catch (const zmq::error_t &e)
+    {
+        if (e.num() == EINTR)
+            return false;
+        throw;
+    }
+}
+
 class Client
 {
 private:
     zmq::socket_t *socket_;
-    TransportProtocol protocol_;
-    IP ip_;
-    Port port_;
+    std::string endpoint_;
 
 public:
-    Client(const std::string &identity, TransportProtocol protocol, const IP &ip, const Port &port) : socket_(nullptr), protocol_(protocol), ip_(ip), port_(port)
+    Client(const std::string &identity, TransportProtocol protocol, const IP &ip, const Port &port) : Client(identity, endpoint(protocol, ip.to_string(), port))
+    {
+    }
+
+    Client(const std::string &identity, const std::string &endpoint) : socket_(nullptr), endpoint_(endpoint)
     {
         socket_ = Context::instance().create_socket(ZMQ_DEALER);
         if (socket_)
         {
             socket_->setsockopt(ZMQ_IDENTITY, identity.data(), identity.size());
-            socket_->connect((protocol_ == TCP ? std::string("tcp") : std::string("udp")).append("://") + ip_.to_string() + ":" + std::to_string(port_));
+            socket_->connect(endpoint_);
             std::this_thread::sleep_for(std::chrono::milliseconds(50));
         }
     }
 
     ~Client()
     {
-        socket_->disconnect((protocol_ == TCP ? std::string("tcp") : std::string("udp")).append("://") + ip_.to_string() + ":" + std::to_string(port_));
+        socket_->disconnect(endpoint_);
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
         socket_->close();
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
     }
 
+    void *handle()
+    {
+        return static_cast<void *>(*socket_);
+    }
+
     void send(std::string const &msg_str)
     {
         socket_->send(msg_str.data(), msg_str.size(), ZMQ_NOBLOCK);
@@ -172,15 +226,26 @@ public:
         socket_->send(data_ptr, data_size, ZMQ_NOBLOCK);
     }
 
-    bool receive(std::stringstream &incoming_msg)
+    // Returns false when the message could not be queued because the send buffer is full. Once the first
+    // frame of a multipart message is queued, the remaining ones always are.
+    bool send(zmq::message_t &msg, bool more = false)
     {
-        if (zmq::message_t msg; socket_->recv(&msg, ZMQ_NOBLOCK) && msg.size() > 0)
-        {
-            incoming_msg.str("");
-            incoming_msg.write(static_cast<char *>(msg.data()), msg.size());
-            return true;
-        }
-        return false;
+        return socket_->send(msg, more ? ZMQ_SNDMORE | ZMQ_NOBLOCK : ZMQ_NOBLOCK);
+    }
+
+    // Any frames after the first one are dropped.
+    bool receive(zmq::message_t &msg)
+    {
+        Frames frames;
+        return receive(msg, frames);
+    }
+
+    bool receive(zmq::message_t &msg, Frames &frames)
+    {
+        if (!socket_->recv(&msg, ZMQ_NOBLOCK))
+            return false;
+        receive_more(*socket_, msg, frames);
+        return msg.size() > 0;
     }
 };
 
@@ -188,28 +253,52 @@ class Server
 {
 private:
     zmq::socket_t *socket_;
-    TransportProtocol protocol_;
-    Port port_;
 
 public:
-    Server(TransportProtocol protocol, const Port &port) : socket_(nullptr), protocol_(protocol), port_(port)
+    Server(TransportProtocol protocol, const Port &port) : Server(endpoint(protocol, "*", port))
+    {
+    }
+
+    Server(const std::string &endpoint) : socket_(nullptr)
     {
         socket_ = Context::instance().create_socket(ZMQ_ROUTER);
         if (socket_)
         {
-            std::string address = (protocol_ == TCP ? std::string("tcp") : std::string("udp")).append("://") + "*:" + std::to_string(port_);
-            socket_->bind(address);
+            try
+            {
+                socket_->bind(endpoint);
+            }
+            catch (...)
+            {
+                // An open socket would keep the context from terminating at exit.
+                socket_->close();
+                throw;
+            }
             std::this_thread::sleep_for(std::chrono::milliseconds(50));
         }
     }
 
     ~Server()
     {
-        //socket_->unbind((protocol_ == TCP ? std::string("tcp") : std::string("udp")).append("://") + "*:" + std::to_string(port_));
         std::this_thread::sleep_for(std::chrono::milliseconds(50));
         socket_->close();
     }
 
+    // Also accepts clients on 'endpoint'; every endpoint feeds the same socket.
+    void bind(const std::string &endpoint)
+    {
+        socket_->bind(endpoint);
+    }
+
+    // The endpoint bound last, with the port the system picked for e.g. "tcp://127.0.0.1:*".
+    std::string last_endpoint() const
+    {
+        char endpoint[256];
+        std::size_t size = sizeof(endpoint);
+        socket_->getsockopt(ZMQ_LAST_ENDPOINT, endpoint, &size);
+        return std::string(endpoint);
+    }
+
     void send(std::string const &reciever_identity, std::string const &mes_str)
     {
         socket_->send(reciever_identity.data(), reciever_identity.size(), ZMQ_SNDMORE | ZMQ_NOBLOCK);
@@ -222,19 +311,47 @@ public:
         socket_->send(data_ptr, data_size, ZMQ_NOBLOCK);
     }
 
-    bool receive(std::string &reciever_identity, std::stringstream &incoming_msg)
+    void *handle()
     {
-        if (zmq::message_t identity; socket_->recv(&identity, ZMQ_RCVMORE | ZMQ_NOBLOCK) && identity.size() > 0)
-        {
-            reciever_identity = std::string(static_cast<char *>(identity.data()), identity.size());
-            if (zmq::message_t msg; socket_->recv(&msg, ZMQ_NOBLOCK) && msg.size() > 0)
-            {
-                incoming_msg.str("");
-                incoming_msg.write(static_cast<char *>(msg.data()), msg.size());
-                return true;
-            }
-        }
-        return false;
+        return static_cast<void *>(*socket_);
+    }
+
+    // Blocks until a message is ready or the timeout (in milliseconds, -1 for infinite) expires.
+    // Returns false on timeout or when the wait was interrupted by a signal.
+    bool wait(long timeout_ms)
+    {
+        zmq::pollitem_t items[] = {{handle(), 0, ZMQ_POLLIN, 0}};
+        return poll(items, 1, timeout_ms) && (items[0].revents & ZMQ_POLLIN) != 0;
+    }
+
+    void send(zmq::message_t &reciever_identity, zmq::message_t &msg)
+    {
+        socket_->send(reciever_identity, ZMQ_SNDMORE | ZMQ_NOBLOCK);
+        socket_->send(msg, ZMQ_NOBLOCK);
+    }
+
+    void send(zmq::message_t &reciever_identity, zmq::message_t &msg, Frames &frames)
+    {
+        socket_->send(reciever_identity, ZMQ_SNDMORE | ZMQ_NOBLOCK);
+        socket_->send(msg, frames.empty() ? ZMQ_NOBLOCK : ZMQ_SNDMORE | ZMQ_NOBLOCK);
+        send_more(*socket_, frames, ZMQ_NOBLOCK);
+    }
+
+    // Any frames after the message are dropped.
+    bool receive(zmq::message_t &reciever_identity, zmq::message_t &msg)
+    {
+        Frames frames;
+        return receive(reciever_identity, msg, frames);
+    }
+
+    bool receive(zmq::message_t &reciever_identity, zmq::message_t &msg, Frames &frames)
+    {
+        if (!socket_->recv(&reciever_identity, ZMQ_NOBLOCK))
+            return false;
+        if (!reciever_identity.more() || !socket_->recv(&msg, ZMQ_NOBLOCK))
+            return false;
+        receive_more(*socket_, msg, frames);
+        return reciever_identity.size() > 0 && msg.size() > 0;
     }
 };
 } // namespace net
@@ -3,71 +3,42 @@
 #define CORE_TIME_UTILITY_H
 
 #include <chrono>
-#include <ctime>
-#include <sstream>
+#include <cstdint>
+#include <ostream>
 #include <string>
-#include <iomanip>
 
-using Clock = std::chrono::system_clock;
-
-union TimeStamp
+// A point in time as nanoseconds on the monotonic clock. Cheap enough to take on every message (no
+// calendar conversion), and never jumps with the wall clock; stamps are only comparable with other stamps
+// taken on the same machine.
+struct TimeStamp
 {
 	std::uint64_t value;
-	struct
-	{
-		std::uint64_t year			: 11;	// max number 2048
-		std::uint64_t day			: 5;	// max number 32
-		std::uint64_t month			: 4;	// max number 16
-		std::uint64_t hour			: 5;	// max number 32
-		std::uint64_t minute		: 6;	// max number 64
-		std::uint64_t second		: 6;	// max number 64
-		std::uint64_t millisecond	: 10;	// max number 1024
-										//17 bits still unused
-	};
 
-	TimeStamp() : value(0)
-	{
-		auto current_time = Clock::now();
-		auto epoch = current_time.time_since_epoch();
-		epoch -= std::chrono::duration_cast<std::chrono::seconds>(epoch);
-		auto ctime = Clock::to_time_t(current_time);
-		auto local_time = std::localtime(&ctime);
+	TimeStamp() : value(now()) { }
+
+	TimeStamp(std::uint64_t time_value) :
+		value(time_value) { }
 
-		year = local_time->tm_year + 1900;
-		month = local_time->tm_mon + 1;
-		day = local_time->tm_mday;
-		hour = local_time->tm_hour;
-		minute = local_time->tm_min;
-		second = local_time->tm_sec;
-		millisecond = static_cast<unsigned>(epoch / std::chrono::milliseconds(1));
+	static std::uint64_t now()
+	{
+		auto epoch = std::chrono::steady_clock::now().time_since_epoch();
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(epoch).count());
 	}
 
-	TimeStamp(std::uint64_t time_value) : 
-		value(time_value) { }
+	std::uint64_t nanoseconds_since(const TimeStamp& earlier) const
+	{
+		return value - earlier.value;
+	}
 
 	friend std::ostream& operator << (std::ostream& stream, const TimeStamp& stamp)
 	{
-		stream << stamp.year << "-"
-			<< std::setfill('0') << std::setw(2) << stamp.month			<< "-"
-			<< std::setfill('0') << std::setw(2) << stamp.day			<< " "
-			<< std::setfill('0') << std::setw(2) << stamp.hour			<< ":"
-			<< std::setfill('0') << std::setw(2) << stamp.minute		<< ":"
-			<< std::setfill('0') << std::setw(2) << stamp.second		<< "."
-			<< std::setfill('0') << std::setw(3) << stamp.millisecond;
+		stream << stamp.value << " ns";
 		return stream;
 	}
 
 	std::string to_str() const
 	{
-		std::stringstream stream;
-		stream << year << "-"
-			<< std::setfill('0') << std::setw(2) << month		<< "-"
-			<< std::setfill('0') << std::setw(2) << day			<< " "
-			<< std::setfill('0') << std::setw(2) << hour		<< ":" 
-			<< std::setfill('0') << std::setw(2) << minute		<< ":" 
-			<< std::setfill('0') << std::setw(2) << second		<< "." 
-			<< std::setfill('0') << std::setw(3) << millisecond;
-		return stream.str();
+		return std::to_string(value) + " ns";
 	}
 };
 